@@ -0,0 +1,50 @@
+#include "arena.hpp"
+
+namespace algrad {
+namespace compiler {
+
+Arena::Arena(AllocationMode mode) noexcept : mode_{mode}, allocated_{0}, cur_{nullptr}, end_{nullptr}, chunks_{nullptr}
+{
+}
+
+Arena::~Arena() noexcept
+{
+    while (chunks_) {
+        auto next = chunks_->next;
+        ::operator delete(chunks_);
+        chunks_ = next;
+    }
+}
+
+void*
+Arena::allocateSlow(std::size_t size, std::size_t alignment)
+{
+    std::size_t header = (sizeof(Chunk) + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+    std::size_t needed = header + size + alignment;
+
+    if (needed > chunkSize_ / 4) {
+        /* Large allocations get a dedicated chunk so the current one can still be filled. */
+        auto chunk = static_cast<Chunk*>(::operator new(needed));
+        if (chunks_) {
+            chunk->next = chunks_->next;
+            chunks_->next = chunk;
+        } else {
+            chunk->next = nullptr;
+            chunks_ = chunk;
+        }
+        allocated_ += size;
+        auto p = reinterpret_cast<std::uintptr_t>(chunk) + header;
+        p = (p + alignment - 1) & ~static_cast<std::uintptr_t>(alignment - 1);
+        return reinterpret_cast<void*>(p);
+    }
+
+    auto chunk = static_cast<Chunk*>(::operator new(chunkSize_));
+    chunk->next = chunks_;
+    chunks_ = chunk;
+    cur_ = reinterpret_cast<char*>(chunk) + header;
+    end_ = reinterpret_cast<char*>(chunk) + chunkSize_;
+
+    return allocate(size, alignment);
+}
+}
+}
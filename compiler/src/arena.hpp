@@ -0,0 +1,172 @@
+#ifndef ALGRAD_COMPILER_ARENA_HPP
+#define ALGRAD_COMPILER_ARENA_HPP
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+
+namespace algrad {
+namespace compiler {
+
+enum class AllocationMode
+{
+    arena,
+    heap
+};
+
+/*
+ * Bump allocator owning all the IR objects of a single program. Individual
+ * deallocations are no-ops, all memory is returned at once when the arena is
+ * destroyed. In heap mode every allocation is forwarded to operator new, which
+ * is only useful to compare against the arena.
+ */
+class Arena
+{
+  public:
+    explicit Arena(AllocationMode mode = AllocationMode::arena) noexcept;
+    ~Arena() noexcept;
+
+    Arena(Arena const&) = delete;
+    Arena& operator=(Arena const&) = delete;
+
+    AllocationMode mode() const noexcept;
+
+    /*
+     * Bytes handed out since the arena was created. Nothing is returned before
+     * the arena is destroyed, so in arena mode this is also its peak usage.
+     */
+    std::size_t allocatedBytes() const noexcept { return allocated_; }
+
+    void* allocate(std::size_t size, std::size_t alignment);
+    void deallocate(void* ptr, std::size_t size) noexcept;
+
+    template <typename T, typename... Args>
+    T* create(Args&&... args);
+
+  private:
+    void* allocateSlow(std::size_t size, std::size_t alignment);
+
+    struct Chunk
+    {
+        Chunk* next;
+    };
+
+    enum
+    {
+        chunkSize_ = 64 * 1024
+    };
+
+    AllocationMode mode_;
+    std::size_t allocated_;
+    char* cur_;
+    char* end_;
+    Chunk* chunks_;
+};
+
+/* Destroys an object allocated in an Arena, to be used with std::unique_ptr. */
+template <typename T>
+class ArenaDeleter
+{
+  public:
+    ArenaDeleter() noexcept : arena_{nullptr} {}
+    explicit ArenaDeleter(Arena* arena) noexcept : arena_{arena} {}
+
+    void operator()(T* ptr) const noexcept;
+
+  private:
+    Arena* arena_;
+};
+
+template <typename T>
+using ArenaPtr = std::unique_ptr<T, ArenaDeleter<T>>;
+
+/* Standard allocator adaptor so containers owned by IR objects can live in the arena. */
+template <typename T>
+class ArenaAllocator
+{
+  public:
+    using value_type = T;
+
+    explicit ArenaAllocator(Arena& arena) noexcept : arena_{&arena} {}
+
+    template <typename U>
+    ArenaAllocator(ArenaAllocator<U> const& other) noexcept : arena_{other.arena()}
+    {
+    }
+
+    T* allocate(std::size_t n) { return static_cast<T*>(arena_->allocate(n * sizeof(T), alignof(T))); }
+    void deallocate(T* ptr, std::size_t n) noexcept { arena_->deallocate(ptr, n * sizeof(T)); }
+
+    Arena* arena() const noexcept { return arena_; }
+
+  private:
+    Arena* arena_;
+};
+
+template <typename T, typename U>
+bool
+operator==(ArenaAllocator<T> const& a, ArenaAllocator<U> const& b) noexcept
+{
+    return a.arena() == b.arena();
+}
+
+template <typename T, typename U>
+bool
+operator!=(ArenaAllocator<T> const& a, ArenaAllocator<U> const& b) noexcept
+{
+    return a.arena() != b.arena();
+}
+
+inline AllocationMode
+Arena::mode() const noexcept
+{
+    return mode_;
+}
+
+inline void*
+Arena::allocate(std::size_t size, std::size_t alignment)
+{
+    assert(alignment && !(alignment & (alignment - 1)));
+    if (mode_ == AllocationMode::heap) {
+        allocated_ += size;
+        return ::operator new(size);
+    }
+
+    auto p = (reinterpret_cast<std::uintptr_t>(cur_) + alignment - 1) & ~static_cast<std::uintptr_t>(alignment - 1);
+    if (!cur_ || p + size > reinterpret_cast<std::uintptr_t>(end_))
+        return allocateSlow(size, alignment);
+
+    cur_ = reinterpret_cast<char*>(p + size);
+    allocated_ += size;
+    return reinterpret_cast<void*>(p);
+}
+
+inline void
+Arena::deallocate(void* ptr, std::size_t) noexcept
+{
+    if (mode_ == AllocationMode::heap)
+        ::operator delete(ptr);
+}
+
+template <typename T, typename... Args>
+T*
+Arena::create(Args&&... args)
+{
+    void* mem = allocate(sizeof(T), alignof(T));
+    return new (mem) T(std::forward<Args>(args)...);
+}
+
+template <typename T>
+void
+ArenaDeleter<T>::operator()(T* ptr) const noexcept
+{
+    ptr->~T();
+    arena_->deallocate(ptr, sizeof(T));
+}
+}
+}
+
+#endif
@@ -0,0 +1,415 @@
+#ifndef ALGRAD_COMPILER_BIT_SET_HPP
+#define ALGRAD_COMPILER_BIT_SET_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace algrad {
+namespace compiler {
+
+inline unsigned
+popCount(std::uint64_t v) noexcept
+{
+#if defined(__GNUC__)
+    return __builtin_popcountll(v);
+#else
+    unsigned count = 0;
+    for (; v; v &= v - 1)
+        ++count;
+    return count;
+#endif
+}
+
+inline unsigned
+countTrailingZeros(std::uint64_t v) noexcept
+{
+    assert(v);
+#if defined(__GNUC__)
+    return __builtin_ctzll(v);
+#else
+    unsigned count = 0;
+    for (; !(v & 1); v >>= 1)
+        ++count;
+    return count;
+#endif
+}
+
+/* Fixed-size dense set of small integers. */
+class BitSet
+{
+  public:
+    using Word = std::uint64_t;
+    enum
+    {
+        wordBits = 64
+    };
+
+    BitSet() noexcept : size_{0} {}
+    explicit BitSet(std::size_t size) : size_{size}, words_((size + wordBits - 1) / wordBits) {}
+
+    std::size_t size() const noexcept { return size_; }
+
+    bool test(std::size_t index) const noexcept;
+    void set(std::size_t index) noexcept;
+    void reset(std::size_t index) noexcept;
+
+    void clear() noexcept;
+    bool empty() const noexcept;
+    std::size_t count() const noexcept;
+
+    /* Returns the first member not smaller than from, or size() if there is none. */
+    std::size_t findNext(std::size_t from) const noexcept;
+
+    template <typename F>
+    void forEach(F&& callback) const;
+
+    std::vector<Word> const& words() const noexcept { return words_; }
+
+    bool operator==(BitSet const& other) const noexcept { return words_ == other.words_; }
+    bool operator!=(BitSet const& other) const noexcept { return words_ != other.words_; }
+
+  private:
+    std::size_t size_;
+    std::vector<Word> words_;
+};
+
+inline bool
+BitSet::test(std::size_t index) const noexcept
+{
+    assert(index < size_);
+    return (words_[index / wordBits] >> (index % wordBits)) & 1U;
+}
+
+inline void
+BitSet::set(std::size_t index) noexcept
+{
+    assert(index < size_);
+    words_[index / wordBits] |= Word{1} << (index % wordBits);
+}
+
+inline void
+BitSet::reset(std::size_t index) noexcept
+{
+    assert(index < size_);
+    words_[index / wordBits] &= ~(Word{1} << (index % wordBits));
+}
+
+inline void
+BitSet::clear() noexcept
+{
+    for (auto& w : words_)
+        w = 0;
+}
+
+inline bool
+BitSet::empty() const noexcept
+{
+    Word acc = 0;
+    for (auto w : words_)
+        acc |= w;
+    return !acc;
+}
+
+inline std::size_t
+BitSet::count() const noexcept
+{
+    std::size_t ret = 0;
+    for (auto w : words_)
+        ret += popCount(w);
+    return ret;
+}
+
+inline std::size_t
+BitSet::findNext(std::size_t from) const noexcept
+{
+    if (from >= size_)
+        return size_;
+
+    auto i = from / wordBits;
+    auto w = words_[i] & (~Word{0} << (from % wordBits));
+    while (!w) {
+        if (++i == words_.size())
+            return size_;
+        w = words_[i];
+    }
+    return i * wordBits + countTrailingZeros(w);
+}
+
+template <typename F>
+void
+BitSet::forEach(F&& callback) const
+{
+    for (std::size_t i = 0; i < words_.size(); ++i) {
+        for (auto w = words_[i]; w; w &= w - 1)
+            callback(i * wordBits + countTrailingZeros(w));
+    }
+}
+
+/*
+ * Sorted list of the non-zero words of a bit set. Used to store many sets that
+ * are small compared to their universe, e.g. the live-in sets of each block.
+ */
+class SparseBitSet
+{
+  public:
+    struct Element
+    {
+        std::uint32_t index;
+        BitSet::Word bits;
+
+        bool operator==(Element const& other) const noexcept { return index == other.index && bits == other.bits; }
+    };
+
+    bool test(std::size_t index) const noexcept;
+    bool empty() const noexcept { return elements_.empty(); }
+    std::size_t count() const noexcept;
+
+    template <typename F>
+    void forEach(F&& callback) const;
+
+    std::vector<Element> const& elements() const noexcept { return elements_; }
+
+    bool operator==(SparseBitSet const& other) const noexcept { return elements_ == other.elements_; }
+    bool operator!=(SparseBitSet const& other) const noexcept { return !(elements_ == other.elements_); }
+
+  private:
+    std::vector<Element> elements_;
+
+    friend class ScratchBitSet;
+};
+
+/*
+ * Dense bit set that remembers which words it touched, so clearing it,
+ * iterating it and converting it to a SparseBitSet only cost time
+ * proportional to its contents instead of to its universe. Sets are merged
+ * a word at a time.
+ */
+class ScratchBitSet
+{
+  public:
+    explicit ScratchBitSet(std::size_t size)
+      : words_((size + BitSet::wordBits - 1) / BitSet::wordBits), isTouched_(words_.size()), sorted_{true}
+    {
+    }
+
+    /* Grows the universe, keeping the current members. */
+    void reserve(std::size_t size);
+
+    bool test(std::size_t index) const noexcept;
+    void set(std::size_t index) noexcept;
+    void reset(std::size_t index) noexcept;
+
+    void clear() noexcept;
+    bool empty() const noexcept;
+    std::size_t count() const noexcept;
+
+    void insertAll(SparseBitSet const& other) noexcept;
+    void insertIntersection(SparseBitSet const& other, BitSet const& mask) noexcept;
+    void insertDifference(SparseBitSet const& other, BitSet const& mask) noexcept;
+
+    /* Visits the members in ascending order. */
+    template <typename F>
+    void forEach(F&& callback);
+
+    /* Returns whether the stored set changed. */
+    bool storeTo(SparseBitSet& out);
+
+  private:
+    void touch(std::size_t word) noexcept;
+    void sortTouched();
+
+    std::vector<BitSet::Word> words_;
+    std::vector<std::uint8_t> isTouched_;
+    std::vector<std::uint32_t> touched_;
+    bool sorted_;
+};
+
+inline bool
+SparseBitSet::test(std::size_t index) const noexcept
+{
+    auto word = static_cast<std::uint32_t>(index / BitSet::wordBits);
+    std::size_t lo = 0, hi = elements_.size();
+    while (lo < hi) {
+        auto mid = (lo + hi) / 2;
+        if (elements_[mid].index < word)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < elements_.size() && elements_[lo].index == word &&
+           ((elements_[lo].bits >> (index % BitSet::wordBits)) & 1U);
+}
+
+inline std::size_t
+SparseBitSet::count() const noexcept
+{
+    std::size_t ret = 0;
+    for (auto const& e : elements_)
+        ret += popCount(e.bits);
+    return ret;
+}
+
+template <typename F>
+void
+SparseBitSet::forEach(F&& callback) const
+{
+    for (auto const& e : elements_) {
+        for (auto w = e.bits; w; w &= w - 1)
+            callback(std::size_t{e.index} * BitSet::wordBits + countTrailingZeros(w));
+    }
+}
+
+inline void
+ScratchBitSet::touch(std::size_t word) noexcept
+{
+    if (!isTouched_[word]) {
+        isTouched_[word] = true;
+        if (!touched_.empty() && touched_.back() > word)
+            sorted_ = false;
+        touched_.push_back(static_cast<std::uint32_t>(word));
+    }
+}
+
+inline void
+ScratchBitSet::sortTouched()
+{
+    if (!sorted_) {
+        std::sort(touched_.begin(), touched_.end());
+        sorted_ = true;
+    }
+}
+
+inline void
+ScratchBitSet::reserve(std::size_t size)
+{
+    auto wordCount = (size + BitSet::wordBits - 1) / BitSet::wordBits;
+    if (wordCount > words_.size()) {
+        words_.resize(wordCount);
+        isTouched_.resize(wordCount);
+    }
+}
+
+inline bool
+ScratchBitSet::test(std::size_t index) const noexcept
+{
+    return (words_[index / BitSet::wordBits] >> (index % BitSet::wordBits)) & 1U;
+}
+
+inline void
+ScratchBitSet::set(std::size_t index) noexcept
+{
+    touch(index / BitSet::wordBits);
+    words_[index / BitSet::wordBits] |= BitSet::Word{1} << (index % BitSet::wordBits);
+}
+
+inline void
+ScratchBitSet::reset(std::size_t index) noexcept
+{
+    words_[index / BitSet::wordBits] &= ~(BitSet::Word{1} << (index % BitSet::wordBits));
+}
+
+inline void
+ScratchBitSet::clear() noexcept
+{
+    for (auto w : touched_) {
+        words_[w] = 0;
+        isTouched_[w] = false;
+    }
+    touched_.clear();
+    sorted_ = true;
+}
+
+inline bool
+ScratchBitSet::empty() const noexcept
+{
+    for (auto w : touched_)
+        if (words_[w])
+            return false;
+    return true;
+}
+
+inline std::size_t
+ScratchBitSet::count() const noexcept
+{
+    std::size_t ret = 0;
+    for (auto w : touched_)
+        ret += popCount(words_[w]);
+    return ret;
+}
+
+inline void
+ScratchBitSet::insertAll(SparseBitSet const& other) noexcept
+{
+    for (auto const& e : other.elements_) {
+        touch(e.index);
+        words_[e.index] |= e.bits;
+    }
+}
+
+inline void
+ScratchBitSet::insertIntersection(SparseBitSet const& other, BitSet const& mask) noexcept
+{
+    auto const& maskWords = mask.words();
+    for (auto const& e : other.elements_) {
+        if (auto bits = e.bits & maskWords[e.index]) {
+            touch(e.index);
+            words_[e.index] |= bits;
+        }
+    }
+}
+
+inline void
+ScratchBitSet::insertDifference(SparseBitSet const& other, BitSet const& mask) noexcept
+{
+    auto const& maskWords = mask.words();
+    for (auto const& e : other.elements_) {
+        if (auto bits = e.bits & ~maskWords[e.index]) {
+            touch(e.index);
+            words_[e.index] |= bits;
+        }
+    }
+}
+
+template <typename F>
+void
+ScratchBitSet::forEach(F&& callback)
+{
+    sortTouched();
+    for (auto i : touched_) {
+        for (auto w = words_[i]; w; w &= w - 1)
+            callback(std::size_t{i} * BitSet::wordBits + countTrailingZeros(w));
+    }
+}
+
+inline bool
+ScratchBitSet::storeTo(SparseBitSet& out)
+{
+    sortTouched();
+    bool changed = false;
+    std::size_t n = 0;
+    for (auto i : touched_) {
+        if (!words_[i])
+            continue;
+        SparseBitSet::Element e{i, words_[i]};
+        if (n < out.elements_.size()) {
+            changed |= !(out.elements_[n] == e);
+            out.elements_[n] = e;
+        } else {
+            changed = true;
+            out.elements_.push_back(e);
+        }
+        ++n;
+    }
+    if (n != out.elements_.size()) {
+        changed = true;
+        out.elements_.resize(n);
+    }
+    return changed;
+}
+}
+}
+
+#endif
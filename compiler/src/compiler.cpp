@@ -0,0 +1,178 @@
+#include "compiler.hpp"
+#include "hir.hpp"
+#include "lir.hpp"
+#include "pass_manager.hpp"
+#include "pass_timing.hpp"
+#include "shader_cache.hpp"
+#include "spirv_loader.hpp"
+#include "trace.hpp"
+
+namespace algrad {
+namespace compiler {
+
+namespace {
+struct Pipeline
+{
+    HIRPassManager hir;
+    LIRPassManager lir;
+};
+
+void
+addHIRAnalyses(HIRPassManager& passes)
+{
+    passes.addAnalysis(analysisRPO, "orderBlocksRPO", noAnalyses,
+                       [](hir::Program& program, hir::Analyses&) { orderBlocksRPO(program); });
+    passes.addAnalysis(analysisDominators, "dominators", analysisRPO,
+                       [](hir::Program& program, hir::Analyses& analyses) {
+                           analyses.dominators.computeDominators(program);
+                       });
+    passes.addAnalysis(analysisPostDominators, "postDominators", analysisRPO,
+                       [](hir::Program& program, hir::Analyses& analyses) {
+                           analyses.postDominators.computePostDominators(program);
+                       });
+    passes.addAnalysis(analysisDivergence, "determineDivergence", noAnalyses,
+                       [](hir::Program& program, hir::Analyses&) { determineDivergence(program); });
+}
+
+void
+addLIRAnalyses(LIRPassManager& passes)
+{
+    passes.addAnalysis(analysisLiveness, "liveness", noAnalyses,
+                       [](lir::Program& program, lir::Analyses& analyses) { analyses.liveness.update(program); });
+}
+
+/*
+ * O0 and O2 only differ in the optimizations that code generation does not
+ * depend on. Passes that can change the control flow graph drop the RPO and
+ * the dominators.
+ */
+Pipeline
+buildPipeline(OptimizationLevel level)
+{
+    Pipeline pipeline;
+    addHIRAnalyses(pipeline.hir);
+    addLIRAnalyses(pipeline.lir);
+
+    pipeline.hir.addPass("splitComposites", noAnalyses, cfgAnalyses,
+                         [](hir::Program& program, hir::Analyses&) { splitComposites(program); });
+    pipeline.hir.addPass("promoteVariables", analysisDominators, cfgAnalyses,
+                         [](hir::Program& program, hir::Analyses& analyses) {
+                             promoteVariables(program, analyses.dominators);
+                         });
+
+    if (level == OptimizationLevel::O2) {
+        pipeline.hir.addPass("propagateConstants", analysisRPO, noAnalyses,
+                             [](hir::Program& program, hir::Analyses&) { propagateConstants(program); });
+        pipeline.hir.addPass("combineInstructions", noAnalyses, cfgAnalyses,
+                             [](hir::Program& program, hir::Analyses&) { combineInstructions(program); });
+    }
+
+    /*
+     * Later passes cannot handle what promotion leaves dead, so O0 needs this
+     * too. O2 also removes the branches that only decide dead values.
+     */
+    if (level == OptimizationLevel::O2) {
+        pipeline.hir.addPass("eliminateDeadCode", analysisPostDominators, analysisDivergence,
+                             [](hir::Program& program, hir::Analyses& analyses) {
+                                 eliminateDeadCode(program, analyses.postDominators);
+                             });
+    } else {
+        pipeline.hir.addPass("eliminateDeadCode", noAnalyses, cfgAnalyses | analysisDivergence,
+                             [](hir::Program& program, hir::Analyses&) { eliminateDeadCode(program); });
+    }
+
+    /* After dead code elimination, which leaves empty blocks where it removed branches. */
+    if (level == OptimizationLevel::O2)
+        pipeline.hir.addPass("simplifyControlFlow", analysisRPO, noAnalyses,
+                             [](hir::Program& program, hir::Analyses&) { simplifyControlFlow(program); });
+    pipeline.hir.addPass("lowerIO", noAnalyses, cfgAnalyses,
+                         [](hir::Program& program, hir::Analyses&) { lowerIO(program); });
+
+    /* After lowerIO, so inputs that are read more than once share their interpolation. */
+    if (level == OptimizationLevel::O2)
+        pipeline.hir.addPass("eliminateCommonSubexpressions", analysisDominators, cfgAnalyses,
+                             [](hir::Program& program, hir::Analyses& analyses) {
+                                 eliminateCommonSubexpressions(program, analyses.dominators);
+                             });
+
+    pipeline.lir.addPass("allocateRegisters", analysisLiveness, noAnalyses,
+                         [](lir::Program& program, lir::Analyses& analyses) {
+                             allocateRegisters(program, analyses.liveness);
+                         });
+    return pipeline;
+}
+
+Pipeline const&
+pipeline(OptimizationLevel level)
+{
+    static Pipeline const o0 = buildPipeline(OptimizationLevel::O0);
+    static Pipeline const o2 = buildPipeline(OptimizationLevel::O2);
+    return level == OptimizationLevel::O0 ? o0 : o2;
+}
+}
+
+bool
+parseOptimizationLevel(std::string const& name, OptimizationLevel& level)
+{
+    if (name == "O0")
+        level = OptimizationLevel::O0;
+    else if (name == "O2")
+        level = OptimizationLevel::O2;
+    else
+        return false;
+    return true;
+}
+
+CompiledShader
+compile(std::uint32_t const* begin, std::uint32_t const* end, std::string const& entryName,
+        CompileOptions const& options, std::vector<std::uint32_t> buffer)
+{
+    Hash128 key{0, 0};
+    if (options.trace)
+        key = ShaderCache::computeKey(begin, end, entryName, options);
+    PassTimer timer(options.timings, options.trace, key);
+    auto const& passes = pipeline(options.optimizationLevel);
+
+    if (timer.enabled())
+        timer.start("loadSPIRV", 0, 0);
+    auto prog = loadSPIRV(begin, end, entryName, options.allocationMode, options.types);
+    if (timer.enabled())
+        timer.stop(instructionCount(*prog), prog->arena().allocatedBytes(), prog->arena().allocatedBytes());
+
+    hir::Analyses hirAnalyses;
+    passes.hir.run(*prog, hirAnalyses, timer);
+    passes.hir.require(*prog, hirAnalyses, analysisRPO | analysisDivergence, timer);
+    if (options.dump)
+        print(*options.dump, *prog);
+
+    /* Both programs are alive during selection, so they both count towards its footprint. */
+    if (timer.enabled())
+        timer.start("selectInstructions", instructionCount(*prog), prog->arena().allocatedBytes());
+    auto lprog = selectInstructions(*prog);
+    if (timer.enabled()) {
+        auto hirBytes = prog->arena().allocatedBytes();
+        timer.stop(instructionCount(*lprog), hirBytes + lprog->arena().allocatedBytes(),
+                   hirBytes + lprog->arena().allocatedBytes());
+    }
+    prog.reset();
+
+    lir::Analyses lirAnalyses;
+    passes.lir.run(*lprog, lirAnalyses, timer);
+    if (options.dump)
+        print(*options.dump, *lprog);
+
+    CompiledShader shader;
+    shader.code = std::move(buffer);
+    if (timer.enabled())
+        timer.start("emit", instructionCount(*lprog), lprog->arena().allocatedBytes());
+    emit(*lprog, shader.code);
+    if (timer.enabled()) {
+        auto bytes = lprog->arena().allocatedBytes() + shader.code.size() * 4;
+        timer.stop(instructionCount(*lprog), bytes, bytes);
+    }
+
+    timer.finish();
+    return shader;
+}
+}
+}
@@ -0,0 +1,65 @@
+#ifndef ALGRAD_COMPILER_COMPILER_HPP
+#define ALGRAD_COMPILER_COMPILER_HPP
+
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "arena.hpp"
+#include "types.hpp"
+
+namespace algrad {
+namespace compiler {
+
+class PassTimings;
+class TraceSink;
+
+/* O0 only runs the passes code generation depends on, for fast JIT compiles. */
+enum class OptimizationLevel
+{
+    O0,
+    O2
+};
+
+/* Accepts the names "O0" and "O2". */
+bool parseOptimizationLevel(std::string const& name, OptimizationLevel& level);
+
+struct CompileOptions
+{
+    AllocationMode allocationMode = AllocationMode::arena;
+    OptimizationLevel optimizationLevel = OptimizationLevel::O2;
+
+    /* Types are interned in this context when set, so it can be shared by many compiles. */
+    std::shared_ptr<TypeContext> types;
+
+    /* The HIR and LIR are printed here when set. */
+    std::ostream* dump = nullptr;
+
+    /* Statistics of every pass are added here when set, it may be shared by concurrent compiles. */
+    PassTimings* timings = nullptr;
+
+    /* A span for the compile and for every pass is added here when set, tagged with the cache key of the module. */
+    TraceSink* trace = nullptr;
+};
+
+struct CompiledShader
+{
+    std::vector<std::uint32_t> code;
+};
+
+/*
+ * Compiles the named entry point of a SPIR-V module to GCN code. Compiles only
+ * share the type context given in the options, so they can run concurrently on
+ * different threads. The IR is allocated from the arenas of the programs,
+ * which are freed before returning, and no files are read or written. The
+ * code is encoded into the storage of buffer, so a caller can keep reusing the
+ * buffer of a previous CompiledShader.
+ */
+CompiledShader compile(std::uint32_t const* begin, std::uint32_t const* end, std::string const& entryName,
+                       CompileOptions const& options, std::vector<std::uint32_t> buffer = {});
+}
+}
+
+#endif
@@ -0,0 +1,323 @@
+#include "hir.hpp"
+#include "hir_inlines.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <vector>
+
+namespace algrad {
+namespace compiler {
+
+using namespace hir;
+
+namespace {
+/* Results are stored as the bit pattern of their width, like the constants they are folded from. */
+template <typename T>
+struct FloatBits;
+
+template <>
+struct FloatBits<float>
+{
+    using type = std::uint32_t;
+};
+
+template <>
+struct FloatBits<double>
+{
+    using type = std::uint64_t;
+};
+
+template <typename T>
+std::uint64_t
+bitsOf(T v) noexcept
+{
+    typename FloatBits<T>::type bits;
+    std::memcpy(&bits, &v, sizeof(bits));
+    return bits;
+}
+
+/* Folding is done in the precision of the type, other widths are not folded. */
+template <typename T>
+ScalarConstant*
+fold(Program& program, Inst& inst, ScalarConstant const& a, ScalarConstant const& b)
+{
+    auto x = static_cast<T>(a.floatLiteral()), y = static_cast<T>(b.floatLiteral());
+    switch (inst.opCode()) {
+        case OpCode::floatAdd:
+            return program.getScalarConstant(inst.type(), bitsOf<T>(x + y));
+        case OpCode::orderedLessThan:
+            return program.getScalarConstant(&boolType, std::uint64_t{x < y});
+        default:
+            return nullptr;
+    }
+}
+
+/*
+ * Sparse conditional constant propagation after Wegman and Zadeck. Values
+ * start out unknown and only move down to a constant and then to varying, and
+ * blocks only become reachable through edges that are known to be taken, so
+ * constants on one side of a branch can fold the branch and the other way
+ * around.
+ */
+class ConstantPropagation
+{
+  public:
+    explicit ConstantPropagation(Program& program);
+
+    void run();
+    void rewrite();
+
+  private:
+    enum class State : std::uint8_t
+    {
+        unknown,
+        constant,
+        varying
+    };
+
+    struct Value
+    {
+        State state;
+        ScalarConstant* constant;
+    };
+
+    Value valueOf(Def& def) const noexcept;
+    void lower(Inst& inst, Value value);
+    void markEdge(BasicBlock& pred, BasicBlock& succ);
+    void evaluate(Inst& inst);
+    Value evaluatePhi(Inst& inst) const;
+    Value evaluateBinary(Inst& inst);
+
+    std::size_t edgeIndex(BasicBlock& pred, BasicBlock& succ) noexcept;
+
+    Program& program_;
+    std::vector<Value> values_;
+    std::vector<bool> reachable_;
+
+    /* One flag per predecessor of every block, the flags of block b start at edgeBegin_[b]. */
+    std::vector<std::size_t> edgeBegin_;
+    std::vector<bool> executable_;
+
+    std::vector<BasicBlock*> blockWorklist_;
+    std::vector<Inst*> instWorklist_;
+};
+
+ConstantPropagation::ConstantPropagation(Program& program)
+  : program_{program}, values_(program.defIdCount(), Value{State::unknown, nullptr})
+{
+    auto& blocks = program.basicBlocks();
+    reachable_.resize(blocks.size());
+    edgeBegin_.resize(blocks.size() + 1);
+    for (auto& bb : blocks)
+        edgeBegin_[bb->id() + 1] = bb->predecessors().size();
+    for (std::size_t i = 0; i < blocks.size(); ++i)
+        edgeBegin_[i + 1] += edgeBegin_[i];
+    executable_.resize(edgeBegin_.back());
+
+    for (auto& p : program.params())
+        values_[p->id()] = {State::varying, nullptr};
+    for (auto& v : program.variables())
+        values_[v.id()] = {State::varying, nullptr};
+}
+
+ConstantPropagation::Value
+ConstantPropagation::valueOf(Def& def) const noexcept
+{
+    if (def.opCode() == OpCode::constant)
+        return {State::constant, static_cast<ScalarConstant*>(&def)};
+    return values_[def.id()];
+}
+
+void
+ConstantPropagation::lower(Inst& inst, Value value)
+{
+    auto& current = values_[inst.id()];
+    if (current.state == value.state && current.constant == value.constant)
+        return;
+
+    current = value;
+    for (auto& use : inst.uses())
+        instWorklist_.push_back(use.consumer());
+}
+
+std::size_t
+ConstantPropagation::edgeIndex(BasicBlock& pred, BasicBlock& succ) noexcept
+{
+    auto& preds = succ.predecessors();
+    return edgeBegin_[succ.id()] + (std::find(preds.begin(), preds.end(), &pred) - preds.begin());
+}
+
+void
+ConstantPropagation::markEdge(BasicBlock& pred, BasicBlock& succ)
+{
+    auto edge = edgeIndex(pred, succ);
+    if (executable_[edge])
+        return;
+    executable_[edge] = true;
+
+    if (!reachable_[succ.id()]) {
+        reachable_[succ.id()] = true;
+        blockWorklist_.push_back(&succ);
+        return;
+    }
+
+    /* The block has been visited already, only its phis see the new edge. */
+    for (auto& inst : succ.instructions()) {
+        if (inst.opCode() != OpCode::phi)
+            break;
+        instWorklist_.push_back(&inst);
+    }
+}
+
+ConstantPropagation::Value
+ConstantPropagation::evaluatePhi(Inst& inst) const
+{
+    auto& bb = *inst.parent();
+    Value result{State::unknown, nullptr};
+    for (std::size_t i = 0; i < inst.operandCount(); ++i) {
+        if (!executable_[edgeBegin_[bb.id()] + i])
+            continue;
+
+        auto value = valueOf(*inst.getOperand(i));
+        if (value.state == State::unknown)
+            continue;
+        if (value.state == State::varying || (result.state == State::constant && result.constant != value.constant))
+            return {State::varying, nullptr};
+        result = value;
+    }
+    return result;
+}
+
+ConstantPropagation::Value
+ConstantPropagation::evaluateBinary(Inst& inst)
+{
+    auto a = valueOf(*inst.getOperand(0)), b = valueOf(*inst.getOperand(1));
+    if (a.state == State::varying || b.state == State::varying)
+        return {State::varying, nullptr};
+    if (a.state == State::unknown || b.state == State::unknown)
+        return {State::unknown, nullptr};
+
+    ScalarConstant* result = nullptr;
+    switch (a.constant->floatWidth()) {
+        case 32:
+            result = fold<float>(program_, inst, *a.constant, *b.constant);
+            break;
+        case 64:
+            result = fold<double>(program_, inst, *a.constant, *b.constant);
+            break;
+    }
+    if (!result)
+        return {State::varying, nullptr};
+    return {State::constant, result};
+}
+
+void
+ConstantPropagation::evaluate(Inst& inst)
+{
+    auto& bb = *inst.parent();
+    switch (inst.opCode()) {
+        case OpCode::phi:
+            lower(inst, evaluatePhi(inst));
+            break;
+        case OpCode::floatAdd:
+        case OpCode::orderedLessThan:
+            lower(inst, evaluateBinary(inst));
+            break;
+        case OpCode::branch:
+            markEdge(bb, *bb.successors()[0]);
+            break;
+        case OpCode::condBranch: {
+            auto condition = valueOf(*inst.getOperand(0));
+            if (condition.state == State::constant)
+                markEdge(bb, *bb.successors()[condition.constant->integerValue() ? 0 : 1]);
+            else if (condition.state == State::varying) {
+                markEdge(bb, *bb.successors()[0]);
+                markEdge(bb, *bb.successors()[1]);
+            }
+        } break;
+        default:
+            if (inst.type() != &voidType)
+                lower(inst, {State::varying, nullptr});
+            break;
+    }
+}
+
+void
+ConstantPropagation::run()
+{
+    auto& entry = program_.initialBlock();
+    reachable_[entry.id()] = true;
+    blockWorklist_.push_back(&entry);
+
+    while (!blockWorklist_.empty() || !instWorklist_.empty()) {
+        while (!instWorklist_.empty()) {
+            auto& inst = *instWorklist_.back();
+            instWorklist_.pop_back();
+            if (inst.parent() && reachable_[inst.parent()->id()])
+                evaluate(inst);
+        }
+        if (!blockWorklist_.empty()) {
+            auto& bb = *blockWorklist_.back();
+            blockWorklist_.pop_back();
+            for (auto& inst : bb.instructions())
+                evaluate(inst);
+        }
+    }
+}
+
+/*
+ * Replaces the constant values, turns branches on a constant into plain
+ * branches and removes the blocks that are never reached along with their
+ * edges. Phis that are left with a single operand are replaced by it.
+ */
+void
+ConstantPropagation::rewrite()
+{
+    auto& blocks = program_.basicBlocks();
+    for (auto& bb : blocks) {
+        if (!reachable_[bb->id()])
+            continue;
+
+        for (auto it = bb->instructions().begin(); it != bb->instructions().end();) {
+            auto& inst = *it++;
+            if (values_[inst.id()].state != State::constant)
+                continue;
+            replace(inst, *values_[inst.id()].constant);
+            bb->erase(inst);
+        }
+
+        auto& successors = bb->successors();
+        if (successors.size() == 2) {
+            auto taken0 = executable_[edgeIndex(*bb, *successors[0])];
+            auto taken1 = executable_[edgeIndex(*bb, *successors[1])];
+            if (taken0 != taken1)
+                bb->branchTo(program_, *successors[taken0 ? 0 : 1]);
+        }
+    }
+
+    removeUnreachableBlocks(program_);
+
+    for (auto& bb : blocks) {
+        for (auto it = bb->instructions().begin(); it != bb->instructions().end();) {
+            auto& inst = *it++;
+            if (inst.opCode() != OpCode::phi)
+                break;
+            if (inst.operandCount() == 1) {
+                replace(inst, *inst.getOperand(0));
+                bb->erase(inst);
+            }
+        }
+    }
+}
+}
+
+void
+propagateConstants(Program& program)
+{
+    ConstantPropagation propagation(program);
+    propagation.run();
+    propagation.rewrite();
+}
+}
+}
@@ -2,22 +2,40 @@
 #include "hir_inlines.hpp"
 
 #include <algorithm>
+#include <iterator>
 #include <queue>
+#include <vector>
 
 namespace algrad {
 namespace compiler {
 
 namespace {
+/*
+ * Depth-first walk with an explicit stack of blocks and the index of their next
+ * successor, so long chains of blocks do not exhaust the native stack.
+ */
 void
-visitRPO(hir::BasicBlock& bb, int& index)
+visitRPO(hir::BasicBlock& root, int& index, std::vector<std::pair<hir::BasicBlock*, std::size_t>>& stack)
 {
-    if (bb.id() >= 0 || bb.id() == -2)
+    if (root.id() >= 0 || root.id() == -2)
         return;
-    bb.setId(-2);
-    for (auto succ : bb.successors())
-        visitRPO(*succ, index);
+    root.setId(-2);
+    stack.push_back({&root, 0});
 
-    bb.setId(--index);
+    while (!stack.empty()) {
+        auto& bb = *stack.back().first;
+        auto succIndex = stack.back().second++;
+        if (succIndex < bb.successors().size()) {
+            auto& succ = *bb.successors()[succIndex];
+            if (succ.id() < 0 && succ.id() != -2) {
+                succ.setId(-2);
+                stack.push_back({&succ, 0});
+            }
+        } else {
+            bb.setId(--index);
+            stack.pop_back();
+        }
+    }
 }
 }
 
@@ -28,23 +46,208 @@ orderBlocksRPO(hir::Program& program)
     for (auto& bb : program.basicBlocks())
         bb->setId(-1);
 
+    std::vector<std::pair<hir::BasicBlock*, std::size_t>> stack;
     for (auto& bb : program.basicBlocks())
-        visitRPO(*bb, index);
+        visitRPO(*bb, index, stack);
+
+    /*
+     * The blocks reachable from the entry got the highest ids and the blocks
+     * that are unreachable the lowest. Rotate them so the entry stays first and
+     * the reachable blocks are numbered from 0.
+     */
+    int reachableStart = program.basicBlocks().front()->id();
+    int blockCount = program.basicBlocks().size();
+    if (reachableStart > 0) {
+        for (auto& bb : program.basicBlocks())
+            bb->setId(bb->id() >= reachableStart ? bb->id() - reachableStart : bb->id() + blockCount - reachableStart);
+    }
 
     std::sort(program.basicBlocks().begin(), program.basicBlocks().end(),
               [](auto& a, auto& b) { return a->id() < b->id(); });
 }
+
+/*
+ * Removes the blocks that cannot be reached from the entry, along with their
+ * edges into the blocks that stay. Needs block ids below the block count.
+ */
+void
+removeUnreachableBlocks(hir::Program& program)
+{
+    auto& blocks = program.basicBlocks();
+    std::vector<bool> reachable(blocks.size());
+    std::vector<hir::BasicBlock*> stack{&program.initialBlock()};
+    reachable[program.initialBlock().id()] = true;
+    while (!stack.empty()) {
+        auto bb = stack.back();
+        stack.pop_back();
+        for (auto succ : bb->successors()) {
+            if (!reachable[succ->id()]) {
+                reachable[succ->id()] = true;
+                stack.push_back(succ);
+            }
+        }
+    }
+
+    for (auto& bb : blocks) {
+        if (reachable[bb->id()])
+            continue;
+        auto& successors = bb->successors();
+        for (auto it = successors.begin(); it != successors.end(); ++it) {
+            if (reachable[(*it)->id()] && std::find(successors.begin(), it, *it) == it)
+                (*it)->erasePredecessor(bb.get());
+        }
+    }
+
+    /* The entry is always reachable, so it stays in front. */
+    blocks.erase(std::remove_if(blocks.begin(), blocks.end(), [&reachable](auto& bb) { return !reachable[bb->id()]; }),
+                 blocks.end());
+}
 namespace {
+bool
+hasPhis(hir::BasicBlock& bb) noexcept
+{
+    return bb.instructions().begin()->opCode() == hir::OpCode::phi;
+}
+
+/* A conditional branch with the same block on both sides is a plain branch. */
+bool
+foldBranch(hir::Program& program, hir::BasicBlock& bb)
+{
+    auto& successors = bb.successors();
+    if (successors.size() != 2 || successors[0] != successors[1])
+        return false;
+
+    bb.branchTo(program, *successors[0]);
+    return true;
+}
+
+/* Appends the single successor of bb to it, if bb is the only way to get there. */
+bool
+mergeSuccessor(hir::Program& program, hir::BasicBlock& bb, std::vector<bool>& removed)
+{
+    if (bb.successors().size() != 1)
+        return false;
+    auto& succ = *bb.successors()[0];
+    if (&succ == &bb || &succ == &program.initialBlock() || succ.predecessors().size() != 1)
+        return false;
+
+    bb.erase(*std::prev(bb.instructions().end()));
+    for (auto it = succ.instructions().begin(); it != succ.instructions().end();) {
+        auto& inst = *it++;
+        if (inst.opCode() == hir::OpCode::phi) {
+            replace(inst, *inst.getOperand(0));
+            succ.erase(inst);
+        } else {
+            bb.insertBack(succ.erase(inst));
+        }
+    }
+
+    auto& successors = succ.successors();
+    for (auto it = successors.begin(); it != successors.end(); ++it) {
+        if (std::find(successors.begin(), it, *it) == it)
+            (*it)->replacePredecessor(&succ, &bb);
+    }
+    bb.successors() = successors;
+    successors.clear();
+    removed[succ.id()] = true;
+    return true;
+}
+
+/*
+ * Lets the predecessors of a block that only branches on jump to its successor
+ * directly, with the values the phis there had for the block. The copies for
+ * phis are made at the end of a predecessor for all of its lanes, so one that
+ * ends in a conditional branch is only threaded to a block without phis.
+ */
+bool
+threadBlock(hir::Program& program, hir::BasicBlock& bb, std::vector<bool>& removed)
+{
+    if (&bb == &program.initialBlock() || bb.instructions().begin()->opCode() != hir::OpCode::branch)
+        return false;
+    auto& succ = *bb.successors()[0];
+    if (&succ == &bb)
+        return false;
+
+    auto& preds = bb.predecessors();
+    if (hasPhis(succ)) {
+        for (auto pred : preds) {
+            if (pred->successors().size() != 1)
+                return false;
+        }
+    }
+
+    auto index = std::find(succ.predecessors().begin(), succ.predecessors().end(), &bb) - succ.predecessors().begin();
+    std::vector<hir::Def*> values;
+    for (auto& inst : succ.instructions()) {
+        if (inst.opCode() != hir::OpCode::phi)
+            break;
+        values.push_back(inst.getOperand(index));
+    }
+
+    succ.erasePredecessor(&bb);
+    for (auto pred : preds) {
+        std::replace(pred->successors().begin(), pred->successors().end(), &bb, &succ);
+        auto count = succ.predecessors().size();
+        if (succ.insertPredecessor(pred) == count) {
+            auto value = values.begin();
+            for (auto& inst : succ.instructions()) {
+                if (inst.opCode() != hir::OpCode::phi)
+                    break;
+                inst.appendOperand(*value++);
+            }
+        }
+        foldBranch(program, *pred);
+    }
+    bb.successors().clear();
+    removed[bb.id()] = true;
+    return true;
+}
+}
+
+/*
+ * The structured control flow from SPIR-V leaves chains of blocks and blocks
+ * that only branch on, which each cost a block start in the generated code.
+ * Merges blocks into their only predecessor and threads branches through
+ * empty blocks until nothing changes. Needs the RPO ids.
+ */
 void
-markVarying(hir::Inst& inst)
+simplifyControlFlow(hir::Program& program)
 {
-    if (inst.isVarying() || !!(inst.flags() & hir::InstFlags::alwaysUniform))
-        return;
+    auto& blocks = program.basicBlocks();
+    std::vector<bool> removed(blocks.size());
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (auto& bb : blocks) {
+            if (removed[bb->id()])
+                continue;
+            while (foldBranch(program, *bb) || mergeSuccessor(program, *bb, removed))
+                changed = true;
+            if (threadBlock(program, *bb, removed))
+                changed = true;
+        }
+    }
+
+    /* The entry is never removed, so it stays in front. */
+    blocks.erase(std::remove_if(blocks.begin(), blocks.end(), [&removed](auto& bb) { return removed[bb->id()]; }),
+                 blocks.end());
+}
+
+namespace {
+void
+markVarying(hir::Inst& root, std::vector<hir::Inst*>& worklist)
+{
+    worklist.push_back(&root);
+    while (!worklist.empty()) {
+        auto& inst = *worklist.back();
+        worklist.pop_back();
+        if (inst.isVarying() || !!(inst.flags() & hir::InstFlags::alwaysUniform))
+            continue;
 
-    inst.markVarying();
+        inst.markVarying();
 
-    for (auto& u : inst.uses()) {
-        markVarying(*u.consumer());
+        for (auto& u : inst.uses()) {
+            worklist.push_back(u.consumer());
+        }
     }
 }
 }
@@ -52,14 +255,15 @@ markVarying(hir::Inst& inst)
 void
 determineDivergence(hir::Program& program)
 {
+    std::vector<hir::Inst*> worklist;
     for (auto& p : program.params()) {
         if (!!(p->flags() & hir::InstFlags::alwaysVarying))
-            markVarying(*p);
+            markVarying(*p, worklist);
     }
     for (auto& bb : program.basicBlocks()) {
         for (auto& inst : bb->instructions()) {
             if (!!(inst.flags() & hir::InstFlags::alwaysVarying) || inst.opCode() == hir::OpCode::phi)
-                markVarying(inst);
+                markVarying(inst, worklist);
         }
     }
 }
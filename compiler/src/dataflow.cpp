@@ -0,0 +1,44 @@
+#include "dataflow.hpp"
+
+namespace algrad {
+namespace compiler {
+namespace lir {
+
+std::vector<Block*>
+computePostOrder(Program& program)
+{
+    std::vector<Block*> order;
+    order.reserve(program.blocks().size());
+    std::vector<bool> visited(program.blocks().size());
+
+    /* Each stack entry is a block and the index of the next successor to visit. */
+    std::vector<std::pair<Block*, std::size_t>> stack;
+    for (auto& root : program.blocks()) {
+        if (visited[root->id()])
+            continue;
+        visited[root->id()] = true;
+        stack.push_back({root.get(), 0});
+
+        while (!stack.empty()) {
+            auto block = stack.back().first;
+            auto index = stack.back().second++;
+            auto logicalCount = block->logicalSuccessors().size();
+
+            if (index < logicalCount + block->linearizedSuccessors().size()) {
+                auto succ = index < logicalCount ? block->logicalSuccessors()[index]
+                                                 : block->linearizedSuccessors()[index - logicalCount];
+                if (!visited[succ->id()]) {
+                    visited[succ->id()] = true;
+                    stack.push_back({succ, 0});
+                }
+            } else {
+                order.push_back(block);
+                stack.pop_back();
+            }
+        }
+    }
+    return order;
+}
+}
+}
+}
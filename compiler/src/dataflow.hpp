@@ -0,0 +1,62 @@
+#ifndef ALGRAD_COMPILER_DATAFLOW_HPP
+#define ALGRAD_COMPILER_DATAFLOW_HPP
+
+#include "bit_set.hpp"
+#include "lir.hpp"
+
+#include <vector>
+
+namespace algrad {
+namespace compiler {
+namespace lir {
+
+/*
+ * Postorder of the blocks over the union of the logical and linearized
+ * edges, starting from the first block. Unreachable blocks are appended.
+ */
+std::vector<Block*> computePostOrder(Program& program);
+
+/*
+ * Solves a backward dataflow problem with a worklist. transfer(block)
+ * recomputes the state at the start of the block from the states of its
+ * successors and returns whether it changed, in which case the predecessors
+ * of the block are queued again. Queued blocks are visited in postorder so
+ * successors are usually final before their predecessors are visited, and
+ * blocks whose successors did not change are never revisited.
+ */
+template <typename Transfer>
+void
+solveBackward(Program& program, Transfer&& transfer)
+{
+    auto order = computePostOrder(program);
+    std::vector<unsigned> position(program.blocks().size());
+    for (std::size_t i = 0; i < order.size(); ++i)
+        position[order[i]->id()] = i;
+
+    BitSet pending(order.size());
+    for (std::size_t i = 0; i < order.size(); ++i)
+        pending.set(i);
+
+    auto queue = [&](BlockList const& preds) {
+        for (auto pred : preds)
+            pending.set(position[pred->id()]);
+    };
+
+    for (auto pos = pending.findNext(0); pos < order.size();) {
+        pending.reset(pos);
+        auto& block = *order[pos];
+        if (transfer(block)) {
+            queue(block.logicalPredecessors());
+            queue(block.linearizedPredecessors());
+        }
+
+        pos = pending.findNext(pos + 1);
+        if (pos == order.size())
+            pos = pending.findNext(0);
+    }
+}
+}
+}
+}
+
+#endif
@@ -1,6 +1,10 @@
+#include "dominance.hpp"
 #include "hir.hpp"
 #include "hir_inlines.hpp"
 
+#include <algorithm>
+#include <vector>
+
 namespace algrad {
 namespace compiler {
 
@@ -8,21 +12,26 @@ using namespace hir;
 
 namespace {
 void
-visit(std::vector<bool>& used, Def& def)
+visit(std::vector<bool>& used, std::vector<Def*>& worklist, Def& root)
 {
-    if (used[def.id()])
-        return;
-    used[def.id()] = true;
-    if (def.opCode() != OpCode::constant) {
-        auto operandCount = static_cast<Inst&>(def).operandCount();
-        for (std::size_t i = 0; i < operandCount; ++i) {
-            visit(used, *static_cast<Inst&>(def).getOperand(i));
+    worklist.push_back(&root);
+    while (!worklist.empty()) {
+        auto& def = *worklist.back();
+        worklist.pop_back();
+        if (used[def.id()])
+            continue;
+        used[def.id()] = true;
+        if (def.opCode() != OpCode::constant) {
+            auto operandCount = static_cast<Inst&>(def).operandCount();
+            for (std::size_t i = 0; i < operandCount; ++i) {
+                worklist.push_back(static_cast<Inst&>(def).getOperand(i));
+            }
         }
     }
 }
 
 void
-eliminate(std::vector<bool> const& used, std::vector<std::unique_ptr<Inst>>& insts)
+eliminate(std::vector<bool> const& used, std::vector<ArenaPtr<Inst>>& insts)
 {
     insts.erase(std::remove_if(insts.begin(), insts.end(), [&used](auto& insn) { return !used[insn->id()]; }),
                 insts.end());
@@ -49,16 +58,195 @@ eliminateVars(std::vector<bool> const& used, Program& program)
             program.eraseVariable(insn);
     }
 }
+
+/*
+ * Marks what is live starting from the instructions with side effects and
+ * the returns only. A block with a live instruction makes the branches it
+ * is control dependent on live, and a live phi makes the branches into its
+ * block live, so only the branches that decide something live remain.
+ */
+class AggressiveDeadCodeElimination
+{
+  public:
+    AggressiveDeadCodeElimination(Program& program, DominatorTree const& postDominators);
+
+    void run();
+
+  private:
+    void markLive(Def& def);
+    void markBlockLive(BasicBlock& bb);
+    void propagate();
+    BasicBlock* liveTarget(BasicBlock& bb) const;
+    bool hasLivePhis(BasicBlock& bb) const;
+    bool keepDeadBranches();
+    void rewrite();
+
+    Program& program_;
+    DominatorTree const& postDominators_;
+    std::vector<bool> used_;
+    std::vector<bool> liveBlocks_;
+    std::vector<Def*> worklist_;
+};
+
+AggressiveDeadCodeElimination::AggressiveDeadCodeElimination(Program& program, DominatorTree const& postDominators)
+  : program_{program}, postDominators_{postDominators}, used_(program.defIdCount()),
+    liveBlocks_(program.basicBlocks().size())
+{
+}
+
+void
+AggressiveDeadCodeElimination::markLive(Def& def)
+{
+    if (!used_[def.id()]) {
+        used_[def.id()] = true;
+        worklist_.push_back(&def);
+    }
+}
+
+void
+AggressiveDeadCodeElimination::markBlockLive(BasicBlock& bb)
+{
+    if (liveBlocks_[bb.id()])
+        return;
+    liveBlocks_[bb.id()] = true;
+    for (auto dependence : postDominators_.frontier(bb))
+        markLive(dependence->instructions().back());
+}
+
+void
+AggressiveDeadCodeElimination::propagate()
+{
+    while (!worklist_.empty()) {
+        auto& def = *worklist_.back();
+        worklist_.pop_back();
+        if (def.opCode() == OpCode::constant)
+            continue;
+
+        auto& inst = static_cast<Inst&>(def);
+        for (std::size_t i = 0; i < inst.operandCount(); ++i)
+            markLive(*inst.getOperand(i));
+
+        if (!inst.parent())
+            continue;
+        markBlockLive(*inst.parent());
+        if (inst.opCode() == OpCode::phi) {
+            for (auto pred : inst.parent()->predecessors()) {
+                markBlockLive(*pred);
+                markLive(pred->instructions().back());
+            }
+        }
+    }
+}
+
+/* The nearest post-dominator with a live instruction, a dead branch can jump there directly. */
+BasicBlock*
+AggressiveDeadCodeElimination::liveTarget(BasicBlock& bb) const
+{
+    auto target = postDominators_.immediateDominator(bb);
+    while (target && !liveBlocks_[target->id()])
+        target = postDominators_.immediateDominator(*target);
+    return target;
+}
+
+bool
+AggressiveDeadCodeElimination::hasLivePhis(BasicBlock& bb) const
+{
+    for (auto& inst : bb.instructions()) {
+        if (inst.opCode() != OpCode::phi)
+            break;
+        if (used_[inst.id()])
+            return true;
+    }
+    return false;
+}
+
+/*
+ * A dead branch keeps its edge to the target if it has one. A new edge
+ * would need operands for the live phis of the target, so if it has any
+ * the branch is kept, as it is when there is no target.
+ */
+bool
+AggressiveDeadCodeElimination::keepDeadBranches()
+{
+    bool changed = false;
+    for (auto& bb : program_.basicBlocks()) {
+        auto& branch = bb->instructions().back();
+        if (branch.opCode() != OpCode::condBranch || used_[branch.id()])
+            continue;
+
+        auto target = liveTarget(*bb);
+        auto& preds = target ? target->predecessors() : bb->predecessors();
+        if (!target || (std::find(preds.begin(), preds.end(), bb.get()) == preds.end() && hasLivePhis(*target))) {
+            markLive(branch);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+void
+AggressiveDeadCodeElimination::rewrite()
+{
+    auto& blocks = program_.basicBlocks();
+    for (auto& bb : blocks) {
+        for (auto it = bb->instructions().begin(); it != bb->instructions().end();) {
+            auto& inst = *it++;
+            if (!used_[inst.id()] && !(inst.flags() & InstFlags::isControlInstruction))
+                bb->erase(inst);
+        }
+    }
+
+    for (auto& bb : blocks) {
+        auto& branch = bb->instructions().back();
+        if (branch.opCode() != OpCode::condBranch || used_[branch.id()])
+            continue;
+
+        bb->branchTo(program_, *liveTarget(*bb));
+    }
+
+    /* The regions the dead branches skip are no longer reachable. */
+    removeUnreachableBlocks(program_);
+
+    eliminateVars(used_, program_);
+    eliminate(used_, program_.params());
+}
+
+void
+AggressiveDeadCodeElimination::run()
+{
+    /*
+     * Control dependence is only known for blocks that can reach a return.
+     * If any block cannot, every branch stays live like in eliminateDeadCode.
+     */
+    bool allBranchesLive = false;
+    for (auto& bb : program_.basicBlocks())
+        allBranchesLive = allBranchesLive || !postDominators_.isReachable(*bb);
+
+    markBlockLive(program_.initialBlock());
+    for (auto& bb : program_.basicBlocks()) {
+        for (auto& inst : bb->instructions()) {
+            if (!!(inst.flags() & InstFlags::hasSideEffects) || inst.opCode() == OpCode::ret ||
+                (allBranchesLive && !!(inst.flags() & InstFlags::isControlInstruction)))
+                markLive(inst);
+        }
+    }
+
+    do
+        propagate();
+    while (keepDeadBranches());
+    rewrite();
+}
 }
 
 void
 eliminateDeadCode(Program& program)
 {
     std::vector<bool> used(program.defIdCount());
+    std::vector<Def*> worklist;
     for (auto& bb : program.basicBlocks()) {
         for (auto& insn : bb->instructions()) {
             if (!!(insn.flags() & (InstFlags::hasSideEffects | InstFlags::isControlInstruction)))
-                visit(used, insn);
+                visit(used, worklist, insn);
         }
     }
     for (auto& bb : program.basicBlocks()) {
@@ -67,5 +255,12 @@ eliminateDeadCode(Program& program)
     eliminateVars(used, program);
     eliminate(used, program.params());
 }
+
+void
+eliminateDeadCode(Program& program, DominatorTree const& postDominators)
+{
+    AggressiveDeadCodeElimination elimination(program, postDominators);
+    elimination.run();
+}
 }
 }
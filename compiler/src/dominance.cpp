@@ -0,0 +1,222 @@
+#include "dominance.hpp"
+#include "hir_inlines.hpp"
+
+#include <utility>
+
+namespace algrad {
+namespace compiler {
+namespace hir {
+
+void
+DominatorTree::computeDominators(Program& program)
+{
+    /* The block ids are a reverse postorder from the entry, which is block 0, so they can be the node numbers. */
+    auto& blocks = program.basicBlocks();
+    number_.resize(blocks.size());
+    blocks_.resize(blocks.size());
+
+    Graph preds;
+    preds.begin.assign(1, 0);
+    preds.edges.clear();
+    for (auto& bb : blocks) {
+        number_[bb->id()] = bb->id();
+        blocks_[bb->id()] = bb.get();
+    }
+    for (auto bb : blocks_) {
+        for (auto pred : bb->predecessors())
+            preds.edges.push_back(pred->id());
+        preds.begin.push_back(static_cast<int>(preds.edges.size()));
+    }
+
+    compute(preds);
+}
+
+void
+DominatorTree::computePostDominators(Program& program)
+{
+    /*
+     * Number the blocks in reverse postorder of the reversed graph, walking from
+     * the virtual exit to the blocks without successors and from every block
+     * to its predecessors.
+     */
+    auto& blocks = program.basicBlocks();
+    auto exit = static_cast<int>(blocks.size());
+    std::vector<BasicBlock*> byId(blocks.size());
+    std::vector<int> exits;
+    for (auto& bb : blocks) {
+        byId[bb->id()] = bb.get();
+        if (bb->successors().empty())
+            exits.push_back(bb->id());
+    }
+
+    std::vector<int> postorder;
+    std::vector<bool> visited(blocks.size() + 1);
+    std::vector<std::pair<int, std::size_t>> stack;
+    stack.push_back({exit, 0});
+    visited[exit] = true;
+    while (!stack.empty()) {
+        auto node = stack.back().first;
+        auto index = stack.back().second++;
+        if (node == exit ? index < exits.size() : index < byId[node]->predecessors().size()) {
+            auto next = node == exit ? exits[index] : byId[node]->predecessors()[index]->id();
+            if (!visited[next]) {
+                visited[next] = true;
+                stack.push_back({next, 0});
+            }
+        } else {
+            postorder.push_back(node);
+            stack.pop_back();
+        }
+    }
+
+    number_.assign(blocks.size(), -1);
+    blocks_.clear();
+    for (auto it = postorder.rbegin(); it != postorder.rend(); ++it) {
+        if (*it != exit)
+            number_[*it] = static_cast<int>(blocks_.size());
+        blocks_.push_back(*it == exit ? nullptr : byId[*it]);
+    }
+
+    /* The predecessors in the reversed graph are the successors that can reach the exit. */
+    Graph preds;
+    preds.begin.assign(2, 0);
+    preds.edges.clear();
+    for (std::size_t i = 1; i < blocks_.size(); ++i) {
+        auto bb = blocks_[i];
+        if (bb->successors().empty())
+            preds.edges.push_back(0);
+        for (auto succ : bb->successors()) {
+            if (number_[succ->id()] >= 0)
+                preds.edges.push_back(number_[succ->id()]);
+        }
+        preds.begin.push_back(static_cast<int>(preds.edges.size()));
+    }
+
+    compute(preds);
+}
+
+/*
+ * Works on nodes numbered in reverse postorder with the root as node 0, which
+ * is what lets intersect walk up the tree by comparing numbers. Nodes that are
+ * unreachable from the root keep an idom of -1 and are dropped from number_.
+ */
+void
+DominatorTree::compute(Graph const& preds)
+{
+    auto nodeCount = static_cast<int>(blocks_.size());
+    idom_.assign(nodeCount, -1);
+    if (nodeCount)
+        idom_[0] = 0;
+
+    auto intersect = [&](int a, int b) {
+        while (a != b) {
+            while (a > b)
+                a = idom_[a];
+            while (b > a)
+                b = idom_[b];
+        }
+        return a;
+    };
+
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (int node = 1; node < nodeCount; ++node) {
+            int idom = -1;
+            for (auto i = preds.begin[node]; i < preds.begin[node + 1]; ++i) {
+                auto pred = preds.edges[i];
+                if (idom_[pred] >= 0)
+                    idom = idom < 0 ? pred : intersect(pred, idom);
+            }
+            if (idom != idom_[node]) {
+                idom_[node] = idom;
+                changed = true;
+            }
+        }
+    }
+
+    for (int node = 1; node < nodeCount; ++node) {
+        if (idom_[node] < 0 && blocks_[node])
+            number_[blocks_[node]->id()] = -1;
+    }
+
+    /* Children in compressed rows, in reverse postorder. */
+    childBegin_.assign(nodeCount + 1, 0);
+    for (int node = 1; node < nodeCount; ++node) {
+        if (idom_[node] >= 0)
+            ++childBegin_[idom_[node] + 1];
+    }
+    for (int node = 0; node < nodeCount; ++node)
+        childBegin_[node + 1] += childBegin_[node];
+
+    std::vector<int> childNodes(nodeCount ? childBegin_[nodeCount] : 0);
+    std::vector<int> fill(childBegin_.begin(), childBegin_.end() - 1);
+    for (int node = 1; node < nodeCount; ++node) {
+        if (idom_[node] >= 0)
+            childNodes[fill[idom_[node]]++] = node;
+    }
+    children_.resize(childNodes.size());
+    for (std::size_t i = 0; i < childNodes.size(); ++i)
+        children_[i] = blocks_[childNodes[i]];
+
+    /* Entry and exit times of a walk over the tree, a dominates b iff b's interval nests in a's. */
+    enter_.assign(nodeCount, 0);
+    exit_.assign(nodeCount, 0);
+    unsigned time = 0;
+    std::vector<std::pair<int, int>> stack;
+    if (nodeCount) {
+        enter_[0] = time++;
+        stack.push_back({0, childBegin_[0]});
+    }
+    while (!stack.empty()) {
+        auto node = stack.back().first;
+        auto index = stack.back().second++;
+        if (index < childBegin_[node + 1]) {
+            auto child = childNodes[index];
+            enter_[child] = time++;
+            stack.push_back({child, childBegin_[child]});
+        } else {
+            exit_[node] = time++;
+            stack.pop_back();
+        }
+    }
+
+    /*
+     * A node is in the frontier of every node on the tree path from its
+     * predecessors up to, but excluding, its immediate dominator. The root
+     * has none, so a back edge to it puts it in the frontier of the whole
+     * path including itself. Each node is handled once, so comparing with the
+     * last node added to a frontier is enough to avoid duplicates.
+     */
+    std::vector<std::pair<int, int>> entries;
+    std::vector<int> last(nodeCount, -1);
+    for (int node = 0; node < nodeCount; ++node) {
+        if (idom_[node] < 0)
+            continue;
+        auto stop = node ? idom_[node] : -1;
+        for (auto i = preds.begin[node]; i < preds.begin[node + 1]; ++i) {
+            auto runner = preds.edges[i];
+            if (idom_[runner] < 0)
+                continue;
+            while (runner != stop) {
+                if (last[runner] != node) {
+                    last[runner] = node;
+                    entries.push_back({runner, node});
+                }
+                runner = runner ? idom_[runner] : -1;
+            }
+        }
+    }
+
+    frontierBegin_.assign(nodeCount + 1, 0);
+    for (auto const& entry : entries)
+        ++frontierBegin_[entry.first + 1];
+    for (int node = 0; node < nodeCount; ++node)
+        frontierBegin_[node + 1] += frontierBegin_[node];
+    frontiers_.resize(entries.size());
+    fill.assign(frontierBegin_.begin(), frontierBegin_.end() - 1);
+    for (auto const& entry : entries)
+        frontiers_[fill[entry.first]++] = blocks_[entry.second];
+}
+}
+}
+}
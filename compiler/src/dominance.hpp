@@ -0,0 +1,157 @@
+#ifndef ALGRAD_COMPILER_DOMINANCE_HPP
+#define ALGRAD_COMPILER_DOMINANCE_HPP
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include <boost/range/iterator_range.hpp>
+
+#include "hir.hpp"
+
+namespace algrad {
+namespace compiler {
+namespace hir {
+
+/*
+ * Dominator or post-dominator tree of a program, computed with the algorithm of
+ * Cooper, Harvey and Kennedy. The dominators are found directly on the block
+ * ids orderBlocksRPO assigns, so those have to be up to date.
+ *
+ * The tree is numbered with the entry and exit times of a depth-first walk,
+ * which makes dominance queries O(1). Blocks that cannot be reached from the
+ * entry, or for post-dominators cannot reach a return, are not in the tree:
+ * they dominate nothing and are dominated by nothing. Post-dominators are
+ * rooted in a virtual exit block that succeeds every block without successors,
+ * so those blocks have no immediate post-dominator.
+ */
+class DominatorTree
+{
+  public:
+    using BlockRange = boost::iterator_range<BasicBlock* const*>;
+
+    void computeDominators(Program& program);
+    void computePostDominators(Program& program);
+
+    bool isReachable(BasicBlock const& bb) const noexcept;
+
+    /* Null for the root and for blocks that are not in the tree. */
+    BasicBlock* immediateDominator(BasicBlock const& bb) const noexcept;
+
+    /* Every block dominates itself. */
+    bool dominates(BasicBlock const& a, BasicBlock const& b) const noexcept;
+    bool strictlyDominates(BasicBlock const& a, BasicBlock const& b) const noexcept;
+
+    BlockRange children(BasicBlock const& bb) const noexcept;
+
+    /* The (post-)dominance frontier; for post-dominators these are the blocks bb is control dependent on. */
+    BlockRange frontier(BasicBlock const& bb) const noexcept;
+
+    /*
+     * Walks the dominator tree depth-first without recursion, calling enter
+     * before the children of a block and leave after them. Blocks that are not
+     * in the tree are walked on their own, in block order after the entry.
+     */
+    template <typename Enter, typename Leave>
+    void walk(Program& program, Enter&& enter, Leave&& leave) const;
+
+  private:
+    /* Edges in compressed rows, the edges of node i are edges[begin[i]] up to edges[begin[i + 1]]. */
+    struct Graph
+    {
+        std::vector<int> begin;
+        std::vector<int> edges;
+    };
+
+    void compute(Graph const& preds);
+
+    /* Tree node of every block, -1 for blocks that are not in the tree. */
+    std::vector<int> number_;
+
+    /* Indexed by node, node 0 is the root. */
+    std::vector<BasicBlock*> blocks_;
+    std::vector<int> idom_;
+    std::vector<unsigned> enter_, exit_;
+    std::vector<int> childBegin_;
+    std::vector<BasicBlock*> children_;
+    std::vector<int> frontierBegin_;
+    std::vector<BasicBlock*> frontiers_;
+};
+
+inline bool
+DominatorTree::isReachable(BasicBlock const& bb) const noexcept
+{
+    return number_[bb.id()] >= 0;
+}
+
+inline BasicBlock*
+DominatorTree::immediateDominator(BasicBlock const& bb) const noexcept
+{
+    auto node = number_[bb.id()];
+    return node > 0 ? blocks_[idom_[node]] : nullptr;
+}
+
+inline bool
+DominatorTree::dominates(BasicBlock const& a, BasicBlock const& b) const noexcept
+{
+    auto na = number_[a.id()], nb = number_[b.id()];
+    if (na < 0 || nb < 0)
+        return &a == &b;
+    return enter_[na] <= enter_[nb] && exit_[nb] <= exit_[na];
+}
+
+inline bool
+DominatorTree::strictlyDominates(BasicBlock const& a, BasicBlock const& b) const noexcept
+{
+    return &a != &b && dominates(a, b);
+}
+
+inline DominatorTree::BlockRange
+DominatorTree::children(BasicBlock const& bb) const noexcept
+{
+    auto node = number_[bb.id()];
+    if (node < 0)
+        return {nullptr, nullptr};
+    return {children_.data() + childBegin_[node], children_.data() + childBegin_[node + 1]};
+}
+
+inline DominatorTree::BlockRange
+DominatorTree::frontier(BasicBlock const& bb) const noexcept
+{
+    auto node = number_[bb.id()];
+    if (node < 0)
+        return {nullptr, nullptr};
+    return {frontiers_.data() + frontierBegin_[node], frontiers_.data() + frontierBegin_[node + 1]};
+}
+
+template <typename Enter, typename Leave>
+void
+DominatorTree::walk(Program& program, Enter&& enter, Leave&& leave) const
+{
+    std::vector<std::pair<BasicBlock*, std::size_t>> stack;
+    for (auto& root : program.basicBlocks()) {
+        if (root.get() != &program.initialBlock() && isReachable(*root))
+            continue;
+
+        enter(*root);
+        stack.push_back({root.get(), 0});
+        while (!stack.empty()) {
+            auto& bb = *stack.back().first;
+            auto index = stack.back().second++;
+            auto blockChildren = children(bb);
+            if (index < blockChildren.size()) {
+                auto& child = *blockChildren[index];
+                enter(child);
+                stack.push_back({&child, 0});
+            } else {
+                leave(bb);
+                stack.pop_back();
+            }
+        }
+    }
+}
+}
+}
+}
+
+#endif
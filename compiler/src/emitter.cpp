@@ -146,7 +146,8 @@ struct vgpr
 class Encoder
 {
   public:
-    Encoder() {}
+    /* Encodes into the storage of buffer, dropping its contents. */
+    explicit Encoder(std::vector<std::uint32_t> buffer) : data_{std::move(buffer)} { data_.clear(); }
 
     void startBlock(lir::Block& block)
     {
@@ -234,6 +235,7 @@ class Encoder
     }
 
     std::vector<std::uint32_t> const& data() const { return data_; }
+    std::vector<std::uint32_t> takeData() noexcept { return std::move(data_); }
 
   private:
     Label killLabel_;
@@ -243,8 +245,8 @@ class Encoder
 class Emitter
 {
   public:
-    Emitter(lir::Program& program)
-      : program{&program}
+    Emitter(lir::Program& program, std::vector<std::uint32_t> buffer)
+      : encoder{std::move(buffer)}, program{&program}
     {
     }
 
@@ -256,6 +258,7 @@ class Emitter
     }
 
     std::vector<std::uint32_t> const& data() const noexcept { return encoder.data(); }
+    std::vector<std::uint32_t> takeData() noexcept { return encoder.takeData(); }
 
     void run()
     {
@@ -448,13 +451,20 @@ Emitter::emitParallelCopy(lir::Inst& insn)
 }
 }
 void
-emit(lir::Program& program)
+emit(lir::Program& program, std::vector<std::uint32_t>& code)
 {
-    Emitter em(program);
+    Emitter em(program, std::move(code));
     em.run();
+    code = em.takeData();
+}
+
+void
+emit(lir::Program& program)
+{
+    std::vector<std::uint32_t> code;
+    emit(program, code);
     std::ofstream os("test.bin");
-    auto const& vec = em.data();
-    os.write(static_cast<char const*>(static_cast<void const*>(vec.data())), vec.size() * sizeof(std::uint32_t));
+    os.write(static_cast<char const*>(static_cast<void const*>(code.data())), code.size() * sizeof(std::uint32_t));
 }
 }
 }
@@ -0,0 +1,127 @@
+#ifndef ALGRAD_COMPILER_HASH_HPP
+#define ALGRAD_COMPILER_HASH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace algrad {
+namespace compiler {
+
+/*
+ * Fast non-cryptographic 64-bit hash that consumes its input eight bytes at
+ * a time. Only meant for content addressing, not for untrusted input.
+ */
+class Hasher
+{
+  public:
+    explicit Hasher(std::uint64_t seed = 0) noexcept : state_{seed ^ k0}, length_{0} {}
+
+    void update(void const* data, std::size_t size) noexcept;
+    void update(std::string const& str) noexcept;
+    void update(std::uint64_t v) noexcept;
+
+    std::uint64_t finish() const noexcept;
+
+  private:
+    void mixWord(std::uint64_t v) noexcept;
+
+    static constexpr std::uint64_t k0 = 0x9e3779b97f4a7c15ULL;
+    static constexpr std::uint64_t k1 = 0xbf58476d1ce4e5b9ULL;
+    static constexpr std::uint64_t k2 = 0x94d049bb133111ebULL;
+
+    std::uint64_t state_;
+    std::uint64_t length_;
+};
+
+struct Hash128
+{
+    std::uint64_t low;
+    std::uint64_t high;
+
+    bool operator==(Hash128 const& other) const noexcept { return low == other.low && high == other.high; }
+    bool operator!=(Hash128 const& other) const noexcept { return !(*this == other); }
+};
+
+/* 128-bit hash made of two independently seeded 64-bit lanes. */
+class Hasher128
+{
+  public:
+    Hasher128() noexcept : low_{0}, high_{0x2545f4914f6cdd1dULL} {}
+
+    template <typename T>
+    void update(T const& value) noexcept
+    {
+        low_.update(value);
+        high_.update(value);
+    }
+
+    void update(void const* data, std::size_t size) noexcept
+    {
+        low_.update(data, size);
+        high_.update(data, size);
+    }
+
+    Hash128 finish() const noexcept { return {low_.finish(), high_.finish()}; }
+
+  private:
+    Hasher low_, high_;
+};
+
+inline void
+Hasher::mixWord(std::uint64_t v) noexcept
+{
+    v *= k1;
+    v ^= v >> 31;
+    v *= k2;
+    state_ = ((state_ ^ v) << 27 | (state_ ^ v) >> 37) * k0 + length_;
+}
+
+inline void
+Hasher::update(void const* data, std::size_t size) noexcept
+{
+    auto bytes = static_cast<unsigned char const*>(data);
+    for (; size >= 8; size -= 8, bytes += 8) {
+        std::uint64_t v;
+        std::memcpy(&v, bytes, 8);
+        length_ += 8;
+        mixWord(v);
+    }
+    if (size) {
+        std::uint64_t v = 0;
+        std::memcpy(&v, bytes, size);
+        length_ += size;
+        mixWord(v);
+    }
+}
+
+inline void
+Hasher::update(std::string const& str) noexcept
+{
+    update(static_cast<std::uint64_t>(str.size()));
+    update(str.data(), str.size());
+}
+
+inline void
+Hasher::update(std::uint64_t v) noexcept
+{
+    length_ += 8;
+    mixWord(v);
+}
+
+inline std::uint64_t
+Hasher::finish() const noexcept
+{
+    auto h = state_ ^ length_;
+    h ^= h >> 33;
+    h *= k1;
+    h ^= h >> 33;
+    h *= k2;
+    h ^= h >> 33;
+    return h;
+}
+}
+}
+
+#endif
@@ -1,6 +1,8 @@
 #include "hir.hpp"
 #include "hir_inlines.hpp"
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 
 namespace algrad {
@@ -28,47 +30,95 @@ replace(Def& old, Def& replacement) noexcept
     }
 }
 
-Inst::Inst(OpCode opCode, int id, Type type, unsigned operandCount) noexcept
-  : Def{opCode, id, type},
-    flags_{defaultInstFlags[static_cast<std::uint16_t>(opCode)]},
-    operands_(operandCount, Use(this)),
-    parent_{nullptr}
+Def*
+trivialPhiValue(Inst& phi) noexcept
+{
+    Def* same = nullptr;
+    for (std::size_t i = 0; i < phi.operandCount(); ++i) {
+        auto op = phi.getOperand(i);
+        if (op == &phi || op == same)
+            continue;
+        if (same)
+            return &phi;
+        same = op;
+    }
+    return same;
+}
+
+Inst::Inst(Arena& arena, OpCode opCode, int id, Type type, unsigned operandCount)
+  : Inst{arena, opCode, id, type, defaultInstFlags[static_cast<std::uint16_t>(opCode)], operandCount}
 {
 }
 
-Inst::Inst(OpCode opCode, int id, Type type, InstFlags flags, unsigned operandCount) noexcept
+Inst::Inst(Arena& arena, OpCode opCode, int id, Type type, InstFlags flags, unsigned operandCount)
   : Def{opCode, id, type},
     flags_{flags},
-    operands_(operandCount, Use(this)),
+    operandCount_{0},
+    operandCapacity_{0},
+    operands_{nullptr},
+    arena_{&arena},
     parent_{nullptr}
 {
+    reserveOperands(operandCount);
+    for (; operandCount_ < operandCount; ++operandCount_)
+        new (operands_ + operandCount_) Use(this);
 }
 
 Inst::~Inst() noexcept
 {
+    for (std::uint32_t i = 0; i < operandCount_; ++i)
+        operands_[i].~Use();
+    if (operands_)
+        arena_->deallocate(operands_, operandCapacity_ * sizeof(Use));
+}
+
+void
+Inst::reserveOperands(unsigned capacity)
+{
+    if (capacity <= operandCapacity_)
+        return;
+
+    auto newOperands = static_cast<Use*>(arena_->allocate(capacity * sizeof(Use), alignof(Use)));
+    for (std::uint32_t i = 0; i < operandCount_; ++i) {
+        new (newOperands + i) Use(operands_[i]);
+        operands_[i].~Use();
+    }
+    if (operands_)
+        arena_->deallocate(operands_, operandCapacity_ * sizeof(Use));
+
+    operands_ = newOperands;
+    operandCapacity_ = capacity;
 }
 
 void
 Inst::eraseOperand(unsigned index) noexcept
 {
-    operands_.erase(operands_.begin() + index);
+    for (std::uint32_t i = index; i + 1 < operandCount_; ++i)
+        operands_[i] = operands_[i + 1];
+    operands_[--operandCount_].~Use();
 }
 
 void
 Inst::appendOperand(Def* def) noexcept
 {
-    operands_.push_back(Use(this));
-    operands_.back().setProducer(def);
+    if (operandCount_ == operandCapacity_)
+        reserveOperands(operandCapacity_ ? operandCapacity_ * 2 : 4);
+    new (operands_ + operandCount_) Use(this);
+    operands_[operandCount_++].setProducer(def);
 }
 
-BasicBlock::BasicBlock(int id)
+BasicBlock::BasicBlock(Arena& arena, int id)
   : id_{id}
+  , arena_{&arena}
+  , successors_(ArenaAllocator<BasicBlock*>{arena})
+  , predecessors_(ArenaAllocator<BasicBlock*>{arena})
 {
 }
 
 BasicBlock::~BasicBlock() noexcept
 {
-    instructions_.clear_and_dispose([](Inst* inst) { delete inst; });
+    ArenaDeleter<Inst> deleter{arena_};
+    instructions_.clear_and_dispose(deleter);
 }
 
 std::size_t
@@ -80,48 +130,123 @@ BasicBlock::insertPredecessor(BasicBlock* pred)
     predecessors_.push_back(pred);
     return predecessors_.size() - 1;
 }
-Program::Program(ProgramType type)
-  : type_{type}
+
+void
+BasicBlock::erasePredecessor(BasicBlock* pred) noexcept
+{
+    auto it = std::find(predecessors_.begin(), predecessors_.end(), pred);
+    auto index = static_cast<unsigned>(it - predecessors_.begin());
+    predecessors_.erase(it);
+    for (auto& inst : instructions_) {
+        if (inst.opCode() != OpCode::phi)
+            break;
+        inst.eraseOperand(index);
+    }
+}
+
+void
+BasicBlock::replacePredecessor(BasicBlock* old, BasicBlock* pred) noexcept
+{
+    *std::find(predecessors_.begin(), predecessors_.end(), old) = pred;
+}
+
+void
+BasicBlock::branchTo(Program& program, BasicBlock& target)
+{
+    for (auto it = successors_.begin(); it != successors_.end(); ++it) {
+        if (*it != &target && std::find(successors_.begin(), it, *it) == it)
+            (*it)->erasePredecessor(this);
+    }
+    if (std::find(successors_.begin(), successors_.end(), &target) == successors_.end())
+        target.insertPredecessor(this);
+
+    erase(instructions_.back());
+    insertBack(program.createDef<Inst>(OpCode::branch, &voidType, 0));
+    successors_.assign(1, &target);
+}
+
+Program::Program(ProgramType type, AllocationMode allocationMode, std::shared_ptr<TypeContext> types)
+  : arena_{allocationMode}
+  , type_{type}
   , nextDefIndex_{0}
   , nextBlockIndex_{0}
+  , types_{types ? std::move(types) : std::make_shared<TypeContext>()}
+  , scalarConstantMap_(0, ConstantKeyHash{}, std::equal_to<ConstantKey>{},
+                       ArenaAllocator<std::pair<ConstantKey const, ScalarConstant*>>{arena_})
 {
 }
 
 Program::~Program() noexcept
 {
-    variables_.clear_and_dispose([](Inst* inst) { delete inst; });
+    ArenaDeleter<Inst> deleter{&arena_};
+    variables_.clear_and_dispose(deleter);
 }
 
-std::unique_ptr<BasicBlock>
+ArenaPtr<BasicBlock>
 Program::createBasicBlock()
 {
-    return std::make_unique<BasicBlock>(nextBlockIndex_++);
+    return ArenaPtr<BasicBlock>{arena_.create<BasicBlock>(arena_, nextBlockIndex_++),
+                                ArenaDeleter<BasicBlock>{&arena_}};
+}
+
+unsigned
+ScalarConstant::floatWidth() const noexcept
+{
+    if (type()->kind() != TypeKind::floatingPoint)
+        return 0;
+    return static_cast<ScalarTypeInfo const*>(type())->width();
+}
+
+double
+ScalarConstant::floatLiteral() const noexcept
+{
+    if (floatWidth() == 32) {
+        auto bits = static_cast<std::uint32_t>(integerValue_);
+        float v;
+        std::memcpy(&v, &bits, sizeof(v));
+        return v;
+    }
+    double v;
+    std::memcpy(&v, &integerValue_, sizeof(v));
+    return v;
+}
+
+std::size_t
+Program::ConstantKeyHash::operator()(ConstantKey const& key) const noexcept
+{
+    auto h = key.bits * 0x9E3779B97F4A7C15ULL;
+    return static_cast<std::size_t>(h ^ (h >> 32)) ^ std::hash<Type>{}(key.type);
 }
 
 ScalarConstant*
 Program::getScalarConstant(Type type, std::uint64_t v)
 {
-    for (auto& e : scalarConstants_) {
-        if (type == e->type() && e->integerValue() == v)
-            return e.get();
+    auto& entry = scalarConstantMap_[ConstantKey{type, v}];
+    if (!entry) {
+        scalarConstants_.emplace_back(arena_.create<ScalarConstant>(OpCode::constant, nextDefIndex_++, type, v),
+                                      ArenaDeleter<ScalarConstant>{&arena_});
+        entry = scalarConstants_.back().get();
     }
-    scalarConstants_.push_back(createDef<ScalarConstant>(OpCode::constant, type, v));
-    return scalarConstants_.back().get();
+    return entry;
 }
 
 ScalarConstant*
 Program::getScalarConstant(Type type, double v)
 {
-    for (auto& e : scalarConstants_) {
-        if (type == e->type() && e->integerValue() == v)
-            return e.get();
+    std::uint64_t bits;
+    std::memcpy(&bits, &v, sizeof(bits));
+
+    auto& entry = scalarConstantMap_[ConstantKey{type, bits}];
+    if (!entry) {
+        scalarConstants_.emplace_back(arena_.create<ScalarConstant>(OpCode::constant, nextDefIndex_++, type, v),
+                                      ArenaDeleter<ScalarConstant>{&arena_});
+        entry = scalarConstants_.back().get();
     }
-    scalarConstants_.push_back(createDef<ScalarConstant>(OpCode::constant, type, v));
-    return scalarConstants_.back().get();
+    return entry;
 }
 
 BasicBlock&
-Program::insertBack(std::unique_ptr<BasicBlock> bb)
+Program::insertBack(ArenaPtr<BasicBlock> bb)
 {
     auto& ret = *bb;
     basicBlocks_.push_back(std::move(bb));
@@ -129,7 +254,7 @@ Program::insertBack(std::unique_ptr<BasicBlock> bb)
 }
 
 Inst&
-Program::appendParam(std::unique_ptr<Inst> param)
+Program::appendParam(ArenaPtr<Inst> param)
 {
     auto& ret = *param;
     params_.push_back(std::move(param));
@@ -169,6 +294,7 @@ void
 print(std::ostream& os, Program& program)
 {
     os << "----- program(" << program.type() << ") ----\n";
+    os << "  constants " << program.scalarConstantCount() << "\n";
 
     os << "  params ";
     for (auto& p : program.params()) {
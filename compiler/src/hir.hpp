@@ -4,7 +4,10 @@
 #include <cstdint>
 #include <iosfwd>
 #include <memory>
+#include <unordered_map>
+#include <vector>
 
+#include "arena.hpp"
 #include "types.hpp"
 
 #include <boost/intrusive/list.hpp>
@@ -128,6 +131,14 @@ class ScalarConstant final : public Def
 
     std::uint64_t integerValue() const noexcept;
 
+    /*
+     * Float constants loaded from SPIR-V hold the bit pattern of their width,
+     * like the literal. floatWidth is 0 for constants of other types, and
+     * floatLiteral decodes widths of 32 and 64 bits, the former exactly widened.
+     */
+    unsigned floatWidth() const noexcept;
+    double floatLiteral() const noexcept;
+
   private:
     union
     {
@@ -140,8 +151,8 @@ class BasicBlock;
 class Inst final : public Def, public boost::intrusive::list_base_hook<>
 {
   public:
-    Inst(OpCode opCode, int id, Type type, unsigned operandCount) noexcept;
-    Inst(OpCode opCode, int id, Type type, InstFlags flags, unsigned operandCount) noexcept;
+    Inst(Arena& arena, OpCode opCode, int id, Type type, unsigned operandCount);
+    Inst(Arena& arena, OpCode opCode, int id, Type type, InstFlags flags, unsigned operandCount);
     ~Inst() noexcept;
 
     std::size_t operandCount() const noexcept;
@@ -162,40 +173,62 @@ class Inst final : public Def, public boost::intrusive::list_base_hook<>
     void markVarying() noexcept;
 
   private:
+    void reserveOperands(unsigned capacity);
+
     InstFlags flags_;
-    std::vector<Use> operands_;
+    std::uint32_t operandCount_;
+    std::uint32_t operandCapacity_;
+    Use* operands_;
+    Arena* arena_;
     BasicBlock* parent_;
 };
 
 using InstList = boost::intrusive::list<Inst>;
 using InstIterator = InstList::iterator;
 
+class BasicBlock;
+class Program;
+using BlockList = std::vector<BasicBlock*, ArenaAllocator<BasicBlock*>>;
+
 class BasicBlock
 {
   public:
-    BasicBlock(int id);
+    BasicBlock(Arena& arena, int id);
     ~BasicBlock() noexcept;
 
     int id() const noexcept;
     void setId(int v) noexcept;
 
-    Inst& insertFront(std::unique_ptr<Inst> insn) noexcept;
-    Inst& insertBack(std::unique_ptr<Inst> insn) noexcept;
-    Inst& insertBefore(Inst& pos, std::unique_ptr<Inst> inst) noexcept;
-    std::unique_ptr<Inst> erase(Inst& inst) noexcept;
+    Inst& insertFront(ArenaPtr<Inst> insn) noexcept;
+    Inst& insertBack(ArenaPtr<Inst> insn) noexcept;
+    Inst& insertBefore(Inst& pos, ArenaPtr<Inst> inst) noexcept;
+    ArenaPtr<Inst> erase(Inst& inst) noexcept;
 
     boost::iterator_range<InstIterator> instructions() noexcept;
 
-    std::vector<BasicBlock*>& successors() noexcept;
-    std::vector<BasicBlock*> const& predecessors() noexcept;
+    BlockList& successors() noexcept;
+    BlockList const& predecessors() noexcept;
 
     std::size_t insertPredecessor(BasicBlock*);
 
+    /* Also removes the operand for pred from the phis, which have to be at the start of the block. */
+    void erasePredecessor(BasicBlock* pred) noexcept;
+
+    /* Keeps the index of the edge, so the phi operands stay with it. */
+    void replacePredecessor(BasicBlock* old, BasicBlock* pred) noexcept;
+
+    /*
+     * Replaces the terminator with a branch to target and drops the edges to
+     * the other successors. target cannot have phis unless it is a successor.
+     */
+    void branchTo(Program& program, BasicBlock& target);
+
   private:
     InstList instructions_;
     int id_;
+    Arena* arena_;
 
-    std::vector<BasicBlock *> successors_, predecessors_;
+    BlockList successors_, predecessors_;
 };
 
 enum class ProgramType
@@ -208,15 +241,18 @@ enum class ProgramType
 class Program
 {
   public:
-    Program(ProgramType);
+    Program(ProgramType, AllocationMode allocationMode = AllocationMode::arena,
+            std::shared_ptr<TypeContext> types = nullptr);
     ~Program() noexcept;
 
     ProgramType type() const noexcept;
 
+    Arena& arena() noexcept;
+
     template <typename T, typename... Args>
-    std::unique_ptr<T> createDef(OpCode opCode, Type type, Args&&... args);
+    ArenaPtr<T> createDef(OpCode opCode, Type type, Args&&... args);
 
-    std::unique_ptr<BasicBlock> createBasicBlock();
+    ArenaPtr<BasicBlock> createBasicBlock();
 
     TypeContext& types() noexcept;
 
@@ -224,43 +260,84 @@ class Program
 
     ScalarConstant* getScalarConstant(Type type, double);
 
+    std::size_t scalarConstantCount() const noexcept;
+
     unsigned defIdCount() const noexcept;
 
-    BasicBlock& insertBack(std::unique_ptr<BasicBlock>);
+    BasicBlock& insertBack(ArenaPtr<BasicBlock>);
 
-    std::vector<std::unique_ptr<BasicBlock>>& basicBlocks() noexcept;
+    std::vector<ArenaPtr<BasicBlock>>& basicBlocks() noexcept;
 
     boost::iterator_range<InstIterator> variables() noexcept;
-    Inst& insertVariable(std::unique_ptr<Inst> inst) noexcept;
-    std::unique_ptr<Inst> eraseVariable(Inst& inst) noexcept;
+    Inst& insertVariable(ArenaPtr<Inst> inst) noexcept;
+    ArenaPtr<Inst> eraseVariable(Inst& inst) noexcept;
 
-    Inst& appendParam(std::unique_ptr<Inst> param);
+    Inst& appendParam(ArenaPtr<Inst> param);
 
-    std::vector<std::unique_ptr<Inst>>& params() noexcept;
+    std::vector<ArenaPtr<Inst>>& params() noexcept;
 
     BasicBlock& initialBlock() noexcept;
 
   private:
+    /* Declared first so that it outlives every object allocated from it. */
+    Arena arena_;
+
     ProgramType type_;
     int nextDefIndex_;
     int nextBlockIndex_;
-    TypeContext types_;
+    std::shared_ptr<TypeContext> types_;
 
-    std::vector<std::unique_ptr<ScalarConstant>> scalarConstants_;
+    /* Constants are hash-consed on their type and the bit pattern of their value. */
+    struct ConstantKey
+    {
+        Type type;
+        std::uint64_t bits;
+
+        bool operator==(ConstantKey const& other) const noexcept
+        {
+            return type == other.type && bits == other.bits;
+        }
+    };
+
+    struct ConstantKeyHash
+    {
+        std::size_t operator()(ConstantKey const& key) const noexcept;
+    };
+
+    using ConstantMap = std::unordered_map<ConstantKey, ScalarConstant*, ConstantKeyHash, std::equal_to<ConstantKey>,
+                                           ArenaAllocator<std::pair<ConstantKey const, ScalarConstant*>>>;
+
+    std::vector<ArenaPtr<ScalarConstant>> scalarConstants_;
+    ConstantMap scalarConstantMap_;
 
-    std::vector<std::unique_ptr<BasicBlock>> basicBlocks_;
+    std::vector<ArenaPtr<BasicBlock>> basicBlocks_;
     InstList variables_;
-    std::vector<std::unique_ptr<Inst>> params_;
+    std::vector<ArenaPtr<Inst>> params_;
 };
 
+/*
+ * The single value a phi merges apart from itself: null if it only merges
+ * itself, and the phi itself if it merges more than one value.
+ */
+Def* trivialPhiValue(Inst& phi) noexcept;
+
 void print(std::ostream& os, Program& program);
+
+class DominatorTree;
 }
 
 void promoteVariables(hir::Program& program);
+void promoteVariables(hir::Program& program, hir::DominatorTree const& dominators);
 void splitComposites(hir::Program& program);
+void propagateConstants(hir::Program& program);
+void combineInstructions(hir::Program& program);
+void eliminateCommonSubexpressions(hir::Program& program, hir::DominatorTree const& dominators);
 void eliminateDeadCode(hir::Program& program);
+void eliminateDeadCode(hir::Program& program, hir::DominatorTree const& postDominators);
 void lowerIO(hir::Program& program);
 void orderBlocksRPO(hir::Program& program);
+void removeUnreachableBlocks(hir::Program& program);
+void simplifyControlFlow(hir::Program& program);
 void determineDivergence(hir::Program& program);
 }
 }
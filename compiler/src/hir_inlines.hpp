@@ -132,7 +132,7 @@ ScalarConstant::integerValue() const noexcept
 inline std::size_t
 Inst::operandCount() const noexcept
 {
-    return operands_.size();
+    return operandCount_;
 }
 
 inline Def*
@@ -190,7 +190,7 @@ BasicBlock::setId(int v) noexcept
 }
 
 inline Inst&
-BasicBlock::insertFront(std::unique_ptr<Inst> insn) noexcept
+BasicBlock::insertFront(ArenaPtr<Inst> insn) noexcept
 {
     insn->setParent(this);
     instructions_.push_front(*insn);
@@ -198,7 +198,7 @@ BasicBlock::insertFront(std::unique_ptr<Inst> insn) noexcept
 }
 
 inline Inst&
-BasicBlock::insertBack(std::unique_ptr<Inst> insn) noexcept
+BasicBlock::insertBack(ArenaPtr<Inst> insn) noexcept
 {
     insn->setParent(this);
     instructions_.push_back(*insn);
@@ -206,19 +206,19 @@ BasicBlock::insertBack(std::unique_ptr<Inst> insn) noexcept
 }
 
 inline Inst&
-BasicBlock::insertBefore(Inst& pos, std::unique_ptr<Inst> inst) noexcept
+BasicBlock::insertBefore(Inst& pos, ArenaPtr<Inst> inst) noexcept
 {
     inst->setParent(this);
     instructions_.insert(InstList::s_iterator_to(pos), *inst);
     return *inst.release();
 }
 
-inline std::unique_ptr<Inst>
+inline ArenaPtr<Inst>
 BasicBlock::erase(Inst& inst) noexcept
 {
     inst.setParent(nullptr);
     instructions_.erase(InstList::s_iterator_to(inst));
-    return std::unique_ptr<Inst>{&inst};
+    return ArenaPtr<Inst>{&inst, ArenaDeleter<Inst>{arena_}};
 }
 
 inline boost::iterator_range<InstIterator>
@@ -227,13 +227,13 @@ BasicBlock::instructions() noexcept
     return instructions_;
 }
 
-inline std::vector<BasicBlock*>&
+inline BlockList&
 BasicBlock::successors() noexcept
 {
     return successors_;
 }
 
-inline std::vector<BasicBlock*> const&
+inline BlockList const&
 BasicBlock::predecessors() noexcept
 {
     return predecessors_;
@@ -245,17 +245,30 @@ Program::type() const noexcept
     return type_;
 }
 
+inline Arena&
+Program::arena() noexcept
+{
+    return arena_;
+}
+
 template <typename T, typename... Args>
-std::unique_ptr<T>
+ArenaPtr<T>
 Program::createDef(OpCode opCode, Type type, Args&&... args)
 {
-    return std::make_unique<T>(opCode, nextDefIndex_++, type, std::forward<Args>(args)...);
+    return ArenaPtr<T>{arena_.create<T>(arena_, opCode, nextDefIndex_++, type, std::forward<Args>(args)...),
+                       ArenaDeleter<T>{&arena_}};
 }
 
 inline TypeContext&
 Program::types() noexcept
 {
-    return types_;
+    return *types_;
+}
+
+inline std::size_t
+Program::scalarConstantCount() const noexcept
+{
+    return scalarConstants_.size();
 }
 
 inline unsigned
@@ -264,7 +277,7 @@ Program::defIdCount() const noexcept
     return nextDefIndex_;
 }
 
-inline std::vector<std::unique_ptr<BasicBlock>>&
+inline std::vector<ArenaPtr<BasicBlock>>&
 Program::basicBlocks() noexcept
 {
     return basicBlocks_;
@@ -277,20 +290,20 @@ Program::variables() noexcept
 }
 
 inline Inst&
-Program::insertVariable(std::unique_ptr<Inst> inst) noexcept
+Program::insertVariable(ArenaPtr<Inst> inst) noexcept
 {
     variables_.push_back(*inst);
     return *inst.release();
 }
 
-inline std::unique_ptr<Inst>
+inline ArenaPtr<Inst>
 Program::eraseVariable(Inst& inst) noexcept
 {
     variables_.erase(InstList::s_iterator_to(inst));
-    return std::unique_ptr<Inst>{&inst};
+    return ArenaPtr<Inst>{&inst, ArenaDeleter<Inst>{&arena_}};
 }
 
-inline std::vector<std::unique_ptr<Inst>>&
+inline std::vector<ArenaPtr<Inst>>&
 Program::params() noexcept
 {
     return params_;
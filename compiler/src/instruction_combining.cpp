@@ -0,0 +1,206 @@
+#include "hir.hpp"
+#include "hir_inlines.hpp"
+
+#include <cmath>
+#include <vector>
+
+namespace algrad {
+namespace compiler {
+
+using namespace hir;
+
+namespace {
+ScalarConstant*
+asConstant(Def* def) noexcept
+{
+    return def->opCode() == OpCode::constant ? static_cast<ScalarConstant*>(def) : nullptr;
+}
+
+/* Only the widths ScalarConstant::floatLiteral decodes. */
+bool
+isFloat(ScalarConstant const& c) noexcept
+{
+    return c.floatWidth() == 32 || c.floatWidth() == 64;
+}
+
+bool
+isNegativeZero(ScalarConstant const& c) noexcept
+{
+    return isFloat(c) && c.floatLiteral() == 0.0 && std::signbit(c.floatLiteral());
+}
+
+bool
+isNaN(ScalarConstant const& c) noexcept
+{
+    return isFloat(c) && std::isnan(c.floatLiteral());
+}
+
+/* The value v is extracted from at index, if def is a single-index compositeExtract. */
+Def*
+extractedFrom(Def& def, std::uint64_t index) noexcept
+{
+    if (def.opCode() != OpCode::compositeExtract)
+        return nullptr;
+    auto& extract = static_cast<Inst&>(def);
+    if (extract.operandCount() != 2 || asConstant(extract.getOperand(1))->integerValue() != index)
+        return nullptr;
+    return extract.getOperand(0);
+}
+
+class InstructionCombiner
+{
+  public:
+    explicit InstructionCombiner(Program& program);
+
+    void run();
+
+  private:
+    void push(Inst& inst);
+    Def* simplify(Inst& inst);
+    Def* simplifyFloatAdd(Inst& inst);
+    Def* simplifyLessThan(Inst& inst);
+    Def* simplifyConstruct(Inst& inst);
+    Def* simplifyExtract(Inst& inst);
+    Def* simplifyPhi(Inst& inst);
+
+    Program& program_;
+    std::vector<Inst*> worklist_;
+    std::vector<bool> queued_;
+};
+
+InstructionCombiner::InstructionCombiner(Program& program) : program_{program}, queued_(program.defIdCount())
+{
+    auto& blocks = program.basicBlocks();
+    for (auto bb = blocks.rbegin(); bb != blocks.rend(); ++bb) {
+        auto insts = (*bb)->instructions();
+        for (auto it = insts.end(); it != insts.begin();)
+            push(*--it);
+    }
+}
+
+void
+InstructionCombiner::push(Inst& inst)
+{
+    if (queued_[inst.id()])
+        return;
+    queued_[inst.id()] = true;
+    worklist_.push_back(&inst);
+}
+
+/*
+ * Simplifies instructions to values that already exist, so a rewrite only
+ * has to revisit the users of the instruction it replaces.
+ */
+void
+InstructionCombiner::run()
+{
+    while (!worklist_.empty()) {
+        auto& inst = *worklist_.back();
+        worklist_.pop_back();
+        queued_[inst.id()] = false;
+
+        auto replacement = simplify(inst);
+        if (!replacement)
+            continue;
+
+        for (auto& use : inst.uses()) {
+            if (use.consumer() != &inst)
+                push(*use.consumer());
+        }
+        replace(inst, *replacement);
+        inst.parent()->erase(inst);
+    }
+}
+
+Def*
+InstructionCombiner::simplify(Inst& inst)
+{
+    switch (inst.opCode()) {
+        case OpCode::floatAdd:
+            return simplifyFloatAdd(inst);
+        case OpCode::orderedLessThan:
+            return simplifyLessThan(inst);
+        case OpCode::compositeConstruct:
+            return simplifyConstruct(inst);
+        case OpCode::compositeExtract:
+            return simplifyExtract(inst);
+        case OpCode::phi:
+            return simplifyPhi(inst);
+        default:
+            return nullptr;
+    }
+}
+
+/*
+ * Constants go to the right, so value numbering sees c + x and x + c as
+ * the same. x + -0.0 is x for every x, x + 0.0 is not for x = -0.0, so
+ * that one is left alone as nothing allows ignoring signed zeros.
+ */
+Def*
+InstructionCombiner::simplifyFloatAdd(Inst& inst)
+{
+    if (asConstant(inst.getOperand(0)) && !asConstant(inst.getOperand(1))) {
+        auto constant = inst.getOperand(0);
+        inst.setOperand(0, inst.getOperand(1));
+        inst.setOperand(1, constant);
+    }
+
+    auto constant = asConstant(inst.getOperand(1));
+    if (constant && isNegativeZero(*constant))
+        return inst.getOperand(0);
+    return nullptr;
+}
+
+/* Ordered comparisons are false if either operand is NaN, and x < x never holds. */
+Def*
+InstructionCombiner::simplifyLessThan(Inst& inst)
+{
+    auto a = asConstant(inst.getOperand(0)), b = asConstant(inst.getOperand(1));
+    if ((a && isNaN(*a)) || (b && isNaN(*b)) || inst.getOperand(0) == inst.getOperand(1))
+        return program_.getScalarConstant(&boolType, std::uint64_t{0});
+    return nullptr;
+}
+
+/*
+ * Putting the elements of a value back together in order gives the value,
+ * which is what splitComposites leaves of an identity shuffle.
+ */
+Def*
+InstructionCombiner::simplifyConstruct(Inst& inst)
+{
+    Def* source = inst.operandCount() ? extractedFrom(*inst.getOperand(0), 0) : nullptr;
+    if (!source || source->type() != inst.type())
+        return nullptr;
+    for (std::size_t i = 1; i < inst.operandCount(); ++i) {
+        if (extractedFrom(*inst.getOperand(i), i) != source)
+            return nullptr;
+    }
+    return source;
+}
+
+Def*
+InstructionCombiner::simplifyExtract(Inst& inst)
+{
+    auto composite = inst.getOperand(0);
+    if (inst.operandCount() != 2 || composite->opCode() != OpCode::compositeConstruct)
+        return nullptr;
+    return static_cast<Inst*>(composite)->getOperand(asConstant(inst.getOperand(1))->integerValue());
+}
+
+/* A phi that merges a single value, apart from itself, is that value. */
+Def*
+InstructionCombiner::simplifyPhi(Inst& inst)
+{
+    auto value = trivialPhiValue(inst);
+    return value != &inst ? value : nullptr;
+}
+}
+
+void
+combineInstructions(Program& program)
+{
+    InstructionCombiner combiner(program);
+    combiner.run();
+}
+}
+}
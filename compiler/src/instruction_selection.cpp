@@ -86,7 +86,7 @@ getSingleVGPR(SelectionContext& ctx, hir::Def& def)
 void
 createStartInstruction(SelectionContext& ctx, lir::Program& lprog, hir::Program& program)
 {
-    auto newInst = std::make_unique<lir::Inst>(lir::OpCode::start, 3, 0);
+    auto newInst = lprog.createInst(lir::OpCode::start, 3, 0);
     newInst->getDefinition(0) = lir::Arg{getReg(ctx, *program.params()[0], lir::RegClass::sgpr, 4), lir::PhysReg{16 * 4}};
     newInst->getDefinition(1) = lir::Arg{getSingleVGPR(ctx, *program.params()[1]), lir::PhysReg{(0 + 256) * 4}};
     newInst->getDefinition(2) = lir::Arg{getSingleVGPR(ctx, *program.params()[2]), lir::PhysReg{(1 + 256) * 4}};
@@ -97,7 +97,7 @@ createStartInstruction(SelectionContext& ctx, lir::Program& lprog, hir::Program&
 void
 createVectorCompare(SelectionContext& ctx, lir::OpCode opCode, hir::Inst& inst, lir::Block& lbb)
 {
-    auto newInst = std::make_unique<lir::Inst>(opCode, 1, 2);
+    auto newInst = ctx.lprog->createInst(opCode, 1, 2);
     newInst->getOperand(0) = lir::Arg{getReg(ctx, *inst.getOperand(0))};
     newInst->getOperand(1) = lir::Arg{getReg(ctx, *inst.getOperand(1))};
     newInst->getDefinition(0) = lir::Arg{getReg(ctx, inst), lir::PhysReg{106 * 4}};
@@ -108,7 +108,7 @@ createVectorCompare(SelectionContext& ctx, lir::OpCode opCode, hir::Inst& inst,
 void
 createLogicalCondBranch(SelectionContext& ctx, hir::Inst& inst, lir::Block& lbb)
 {
-    auto newInst = std::make_unique<lir::Inst>(lir::OpCode::logical_cond_branch, 2, 1);
+    auto newInst = ctx.lprog->createInst(lir::OpCode::logical_cond_branch, 2, 1);
     newInst->getOperand(0) = lir::Arg{getReg(ctx, *inst.getOperand(0))};
 
     newInst->getDefinition(0) =
@@ -121,7 +121,7 @@ createLogicalCondBranch(SelectionContext& ctx, hir::Inst& inst, lir::Block& lbb)
 void
 createLogicalBranch(SelectionContext& ctx, hir::Inst& inst, lir::Block& lbb)
 {
-    auto newInst = std::make_unique<lir::Inst>(lir::OpCode::logical_branch, 1, 0);
+    auto newInst = ctx.lprog->createInst(lir::OpCode::logical_branch, 1, 0);
 
     newInst->getDefinition(0) =
       lir::Arg{lir::Temp_id{ctx.controlFlowVars.find({&lbb, lbb.logicalSuccessors()[0]})->second}};
@@ -131,7 +131,7 @@ createLogicalBranch(SelectionContext& ctx, hir::Inst& inst, lir::Block& lbb)
 void
 createVectorPhi(SelectionContext& ctx, hir::Inst& inst, lir::Block& lbb)
 {
-    auto newInst = std::make_unique<lir::Inst>(lir::OpCode::phi, 1, lbb.logicalPredecessors().size());
+    auto newInst = ctx.lprog->createInst(lir::OpCode::phi, 1, lbb.logicalPredecessors().size());
     for (unsigned i = 0; i < lbb.logicalPredecessors().size(); ++i) {
         newInst->getOperand(i) = lir::Arg{getReg(ctx, *inst.getOperand(i))};
     }
@@ -148,7 +148,7 @@ createBlockStart(SelectionContext& ctx, lir::Block& lbb, hir::Program& program)
         return;
     }
 
-    auto newInst = std::make_unique<lir::Inst>(lir::OpCode::start_block, 0, lbb.logicalPredecessors().size());
+    auto newInst = ctx.lprog->createInst(lir::OpCode::start_block, 0, lbb.logicalPredecessors().size());
     for (unsigned i = 0; i < lbb.logicalPredecessors().size(); ++i) {
         newInst->getOperand(i) = lir::Arg{
           lir::Temp_id{ctx.controlFlowVars.find({lbb.logicalPredecessors()[i], &lbb})->second}};
@@ -163,11 +163,11 @@ selectInstructions(hir::Program& program)
     ctx.regClasses = computeRegisterClasses(program);
     ctx.regMap.resize(program.defIdCount(), ~0U);
 
-    auto lprog = std::make_unique<lir::Program>();
+    auto lprog = std::make_unique<lir::Program>(program.arena().mode());
     ctx.lprog = lprog.get();
 
     for (auto& bb : program.basicBlocks()) {
-        ctx.lprog->blocks().push_back(std::make_unique<lir::Block>(bb->id()));
+        ctx.lprog->blocks().push_back(ctx.lprog->createBlock(bb->id()));
     }
     for (int i = program.basicBlocks().size() - 1; i >= 0; --i) {
         auto& bb = *program.basicBlocks()[i];
@@ -195,13 +195,13 @@ selectInstructions(hir::Program& program)
         for (auto& insn : boost::adaptors::reverse(bb.instructions())) {
             switch (insn.opCode()) {
                 case hir::OpCode::ret:
-                    lbb.instructions().push_back(std::make_unique<lir::Inst>(lir::OpCode::s_endpgm, 0, 0));
+                    lbb.instructions().push_back(lprog->createInst(lir::OpCode::s_endpgm, 0, 0));
                     break;
                 case hir::OpCode::gcnInterpolate: {
                     auto attribute = static_cast<hir::ScalarConstant*>(insn.getOperand(3))->integerValue();
                     auto component = static_cast<hir::ScalarConstant*>(insn.getOperand(4))->integerValue();
-                    auto p1 = std::make_unique<lir::Inst>(lir::OpCode::v_interp_p1_f32, 1, 2); //(attribute, component);
-                    auto p2 = std::make_unique<lir::Inst>(lir::OpCode::v_interp_p2_f32, 1, 3); //(attribute, component);
+                    auto p1 = lprog->createInst(lir::OpCode::v_interp_p1_f32, 1, 2); //(attribute, component);
+                    auto p2 = lprog->createInst(lir::OpCode::v_interp_p2_f32, 1, 3); //(attribute, component);
 
                     lir::Temp_id tmp = lprog->allocate_temp(lir::RegClass::vgpr, 4);
                     p1->getDefinition(0) = lir::Arg{tmp};
@@ -221,7 +221,7 @@ selectInstructions(hir::Program& program)
                     lbb.instructions().emplace_back(std::move(p1));
                 } break;
                 case hir::OpCode::gcnExport: {
-                    auto exp = std::make_unique<lir::Inst>(lir::OpCode::exp, 0, 4);
+                    auto exp = lprog->createInst(lir::OpCode::exp, 0, 4);
 
                     exp->getOperand(0) = lir::Arg{getSingleVGPR(ctx, *insn.getOperand(3))};
                     exp->getOperand(1) = lir::Arg{getSingleVGPR(ctx, *insn.getOperand(4))};
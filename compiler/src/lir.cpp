@@ -1,6 +1,7 @@
 #include "lir.hpp"
 
 #include <algorithm>
+#include <limits>
 
 namespace algrad {
 namespace compiler {
@@ -14,16 +15,12 @@ Inst::Inst(OpCode opCode, std::size_t defCount, std::size_t opCount) noexcept
     assert(defCount <= std::numeric_limits<std::uint16_t>::max());
     assert(opCount <= std::numeric_limits<std::uint16_t>::max());
     if (defCount_ + opCount_ > internalArgCount_)
-        externalArgs_ = new Arg[defCount + opCount_];
+        externalArgs_ = reinterpret_cast<Arg*>(this + 1);
 }
 
-Inst::~Inst() noexcept
-{
-    if (defCount_ + opCount_ > internalArgCount_)
-        delete[] externalArgs_;
-}
-
-Program::Program()
+Program::Program(AllocationMode allocationMode)
+  : arena_{allocationMode},
+    version_{0}
 {
 }
 
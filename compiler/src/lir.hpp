@@ -2,10 +2,14 @@
 #define ALGRAD_LIR_HPP
 
 #include <boost/range/iterator_range.hpp>
+#include <cassert>
 #include <cstdint>
 #include <cstring>
 #include <iosfwd>
 #include <memory>
+#include <vector>
+
+#include "arena.hpp"
 
 namespace algrad {
 namespace compiler {
@@ -15,6 +19,8 @@ class Program;
 }
 
 namespace lir {
+class Liveness;
+
 template <typename T, unsigned a, unsigned b, typename T2 = T>
 struct BitField
 {
@@ -131,12 +137,11 @@ union AuxiliaryInstInfo
     AuxiliaryEXPInfo exp;
 };
 
+class Program;
+
 class Inst final
 {
   public:
-    Inst(OpCode opCode, std::size_t defCount, std::size_t opCount) noexcept;
-    ~Inst() noexcept;
-
     OpCode opCode() const noexcept;
 
     std::size_t operandCount() const noexcept { return opCount_; }
@@ -149,6 +154,11 @@ class Inst final
     AuxiliaryInstInfo const& aux() const noexcept { return aux_; }
 
   private:
+    /* Only created through Program::createInst, which co-allocates the external arguments. */
+    Inst(OpCode opCode, std::size_t defCount, std::size_t opCount) noexcept;
+
+    static std::size_t allocationSize(std::size_t defCount, std::size_t opCount) noexcept;
+
     Arg* args() noexcept;
     Arg const* args() const noexcept;
 
@@ -167,32 +177,38 @@ class Inst final
     };
 
     AuxiliaryInstInfo aux_;
+
+    friend class Program;
 };
 
+class Block;
+using InstVector = std::vector<ArenaPtr<Inst>, ArenaAllocator<ArenaPtr<Inst>>>;
+using BlockList = std::vector<Block*, ArenaAllocator<Block*>>;
+
 class Block
 {
   public:
-    Block(int id) noexcept : id_{id} {}
+    Block(Arena& arena, int id) noexcept;
 
     int id() const noexcept { return id_; }
 
-    std::vector<std::unique_ptr<Inst>>& instructions() noexcept;
+    InstVector& instructions() noexcept;
 
-    std::vector<Block*>& logicalPredecessors() noexcept;
-    std::vector<Block*>& logicalSuccessors() noexcept;
-    std::vector<Block*>& linearizedPredecessors() noexcept;
-    std::vector<Block*>& linearizedSuccessors() noexcept;
+    BlockList& logicalPredecessors() noexcept;
+    BlockList& logicalSuccessors() noexcept;
+    BlockList& linearizedPredecessors() noexcept;
+    BlockList& linearizedSuccessors() noexcept;
 
   private:
     int id_;
-    std::vector<std::unique_ptr<Inst>> instructions_;
-    std::vector<Block *> logicalPredecessors_, logicalSuccessors_;
-    std::vector<Block *> linearizedPredecessors_, linearizedSuccessors_;
+    InstVector instructions_;
+    BlockList logicalPredecessors_, logicalSuccessors_;
+    BlockList linearizedPredecessors_, linearizedSuccessors_;
 };
 
-std::size_t findOrInsertBlock(std::vector<Block*>& arr, Block*);
-std::size_t renameBlock(std::vector<Block*>& arr, Block* old, Block* replacement) noexcept;
-std::size_t removeBlock(std::vector<Block*>& arr, Block*) noexcept;
+std::size_t findOrInsertBlock(BlockList& arr, Block*);
+std::size_t renameBlock(BlockList& arr, Block* old, Block* replacement) noexcept;
+std::size_t removeBlock(BlockList& arr, Block*) noexcept;
 
 struct Temp_info
 {
@@ -203,15 +219,34 @@ struct Temp_info
 class Program
 {
   public:
-    Program();
-    std::vector<std::unique_ptr<Block>>& blocks() noexcept;
+    Program(AllocationMode allocationMode = AllocationMode::arena);
+
+    Arena& arena() noexcept;
+
+    ArenaPtr<Inst> createInst(OpCode opCode, std::size_t defCount, std::size_t opCount);
+    ArenaPtr<Block> createBlock(int id);
+
+    InstVector createInstVector();
+
+    std::vector<ArenaPtr<Block>>& blocks() noexcept;
 
     std::uint32_t allocate_temp(RegClass reg_class, unsigned size) noexcept;
     Temp_info const& temp_info(std::uint32_t index) const noexcept;
     std::uint32_t allocated_temp_count() const noexcept;
 
+    /*
+     * Passes changing the instructions bump the version, which invalidates
+     * cached analyses such as Liveness.
+     */
+    std::uint64_t version() const noexcept { return version_; }
+    void markModified() noexcept { ++version_; }
+
   private:
-    std::vector<std::unique_ptr<Block>> blocks_;
+    /* Declared first so that it outlives the blocks and instructions. */
+    Arena arena_;
+    std::uint64_t version_;
+
+    std::vector<ArenaPtr<Block>> blocks_;
     std::vector<Temp_info> temps_;
 };
 
@@ -330,38 +365,56 @@ Inst::args() const noexcept
         return internalArgs_;
 }
 
-inline std::vector<std::unique_ptr<Inst>>&
+inline std::size_t
+Inst::allocationSize(std::size_t defCount, std::size_t opCount) noexcept
+{
+    if (defCount + opCount > internalArgCount_)
+        return sizeof(Inst) + (defCount + opCount) * sizeof(Arg);
+    return sizeof(Inst);
+}
+
+inline Block::Block(Arena& arena, int id) noexcept
+  : id_{id},
+    instructions_(ArenaAllocator<ArenaPtr<Inst>>{arena}),
+    logicalPredecessors_(ArenaAllocator<Block*>{arena}),
+    logicalSuccessors_(ArenaAllocator<Block*>{arena}),
+    linearizedPredecessors_(ArenaAllocator<Block*>{arena}),
+    linearizedSuccessors_(ArenaAllocator<Block*>{arena})
+{
+}
+
+inline InstVector&
 Block::instructions() noexcept
 {
     return instructions_;
 }
 
-inline std::vector<Block*>&
+inline BlockList&
 Block::logicalPredecessors() noexcept
 {
     return logicalPredecessors_;
 }
 
-inline std::vector<Block*>&
+inline BlockList&
 Block::logicalSuccessors() noexcept
 {
     return logicalSuccessors_;
 }
 
-inline std::vector<Block*>&
+inline BlockList&
 Block::linearizedPredecessors() noexcept
 {
     return linearizedPredecessors_;
 }
 
-inline std::vector<Block*>&
+inline BlockList&
 Block::linearizedSuccessors() noexcept
 {
     return linearizedSuccessors_;
 }
 
 inline std::size_t
-findOrInsertBlock(std::vector<Block*>& arr, Block* n)
+findOrInsertBlock(BlockList& arr, Block* n)
 {
     for (std::size_t i = 0; i < arr.size(); ++i) {
         if (arr[i] == n) {
@@ -374,7 +427,7 @@ findOrInsertBlock(std::vector<Block*>& arr, Block* n)
 }
 
 inline std::size_t
-findBlock(std::vector<Block*>& arr, Block* n)
+findBlock(BlockList& arr, Block* n)
 {
     for (std::size_t i = 0; i < arr.size(); ++i) {
         if (arr[i] == n) {
@@ -385,7 +438,7 @@ findBlock(std::vector<Block*>& arr, Block* n)
 }
 
 inline std::size_t
-renameBlock(std::vector<Block*>& arr, Block* old, Block* replacement) noexcept
+renameBlock(BlockList& arr, Block* old, Block* replacement) noexcept
 {
     for (std::size_t i = 0; i < arr.size(); ++i) {
         if (arr[i] == old) {
@@ -397,7 +450,7 @@ renameBlock(std::vector<Block*>& arr, Block* old, Block* replacement) noexcept
 }
 
 inline std::size_t
-removeBlock(std::vector<Block*>& arr, Block* b) noexcept
+removeBlock(BlockList& arr, Block* b) noexcept
 {
     for (std::size_t i = 0; i < arr.size(); ++i) {
         if (arr[i] == b) {
@@ -408,6 +461,31 @@ removeBlock(std::vector<Block*>& arr, Block* b) noexcept
     std::terminate();
 }
 
+inline Arena&
+Program::arena() noexcept
+{
+    return arena_;
+}
+
+inline ArenaPtr<Inst>
+Program::createInst(OpCode opCode, std::size_t defCount, std::size_t opCount)
+{
+    void* mem = arena_.allocate(Inst::allocationSize(defCount, opCount), alignof(Inst));
+    return ArenaPtr<Inst>{new (mem) Inst(opCode, defCount, opCount), ArenaDeleter<Inst>{&arena_}};
+}
+
+inline ArenaPtr<Block>
+Program::createBlock(int id)
+{
+    return ArenaPtr<Block>{arena_.create<Block>(arena_, id), ArenaDeleter<Block>{&arena_}};
+}
+
+inline InstVector
+Program::createInstVector()
+{
+    return InstVector(ArenaAllocator<ArenaPtr<Inst>>{arena_});
+}
+
 inline std::uint32_t
 Program::allocate_temp(RegClass reg_class, unsigned size) noexcept
 {
@@ -428,7 +506,7 @@ Program::allocated_temp_count() const noexcept
     return temps_.size();
 }
 
-inline std::vector<std::unique_ptr<Block>>&
+inline std::vector<ArenaPtr<Block>>&
 Program::blocks() noexcept
 {
     return blocks_;
@@ -437,7 +515,11 @@ Program::blocks() noexcept
 
 std::unique_ptr<lir::Program> selectInstructions(hir::Program& program);
 void allocateRegisters(lir::Program& program);
+/* Starts from the given liveness, which is no longer valid afterwards. */
+void allocateRegisters(lir::Program& program, lir::Liveness& liveness);
 void emit(lir::Program& program);
+/* Replaces the contents of code with the encoded program, reusing its storage. */
+void emit(lir::Program& program, std::vector<std::uint32_t>& code);
 }
 }
 #endif
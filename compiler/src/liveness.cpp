@@ -0,0 +1,97 @@
+#include "liveness.hpp"
+#include "dataflow.hpp"
+
+#include <limits>
+
+#include <boost/range/adaptor/reversed.hpp>
+
+namespace algrad {
+namespace compiler {
+namespace lir {
+
+Liveness::Liveness() noexcept : version_{std::numeric_limits<std::uint64_t>::max()}
+{
+}
+
+void
+Liveness::compute(Program& program)
+{
+    liveIn_.clear();
+    liveIn_.resize(program.blocks().size());
+    version_ = std::numeric_limits<std::uint64_t>::max();
+    markValid(program);
+
+    ScratchBitSet live(program.allocated_temp_count());
+    solveBackward(program, [&](Block& bb) {
+        computeLiveOut(bb, live);
+        for (auto& insn : boost::adaptors::reverse(bb.instructions())) {
+            auto defCount = insn->definitionCount();
+            for (unsigned i = 0; i < defCount; ++i)
+                live.reset(insn->getDefinition(i).temp());
+
+            if (insn->opCode() != OpCode::phi) {
+                auto opCount = insn->operandCount();
+                for (unsigned i = 0; i < opCount; ++i) {
+                    if (insn->getOperand(i).is_temp())
+                        insn->getOperand(i).setKill(!live.test(insn->getOperand(i).temp()));
+                }
+                for (unsigned i = 0; i < opCount; ++i) {
+                    if (insn->getOperand(i).is_temp())
+                        live.set(insn->getOperand(i).temp());
+                }
+            }
+        }
+        return live.storeTo(liveIn_[bb.id()]);
+    });
+}
+
+void
+Liveness::update(Program& program)
+{
+    if (!isValid(program))
+        compute(program);
+}
+
+bool
+Liveness::isValid(Program const& program) const noexcept
+{
+    return version_ == program.version();
+}
+
+void
+Liveness::markValid(Program const& program)
+{
+    version_ = program.version();
+    if (vgprs_.size() == program.allocated_temp_count())
+        return;
+
+    vgprs_ = BitSet(program.allocated_temp_count());
+    for (unsigned i = 0; i < program.allocated_temp_count(); ++i)
+        if (program.temp_info(i).reg_class == RegClass::vgpr)
+            vgprs_.set(i);
+}
+
+void
+Liveness::computeLiveOut(Block& bb, ScratchBitSet& ret) const
+{
+    ret.clear();
+    for (int logical = 0; logical < 2; ++logical) {
+        for (auto succ : (logical ? bb.logicalSuccessors() : bb.linearizedSuccessors())) {
+            if (logical)
+                ret.insertIntersection(liveIn_[succ->id()], vgprs_);
+            else
+                ret.insertDifference(liveIn_[succ->id()], vgprs_);
+
+            auto index = findBlock(logical ? succ->logicalPredecessors() : succ->linearizedPredecessors(), &bb);
+            for (auto& insn : succ->instructions()) {
+                if (insn->opCode() != OpCode::phi)
+                    break;
+                if (logical == vgprs_.test(insn->getDefinition(0).temp()))
+                    ret.set(insn->getOperand(index).temp());
+            }
+        }
+    }
+}
+}
+}
+}
@@ -0,0 +1,49 @@
+#ifndef ALGRAD_COMPILER_LIVENESS_HPP
+#define ALGRAD_COMPILER_LIVENESS_HPP
+
+#include "bit_set.hpp"
+#include "lir.hpp"
+
+#include <vector>
+
+namespace algrad {
+namespace compiler {
+namespace lir {
+
+/*
+ * Live-in sets of the blocks of a program. VGPRs are live along the logical
+ * edges, everything else along the linearized edges. Computing the liveness
+ * also sets the kill flags of the operands.
+ *
+ * The result stays valid until the program version changes. Passes that
+ * update the liveness themselves while changing the program can call
+ * markValid afterwards to keep using it.
+ */
+class Liveness
+{
+  public:
+    Liveness() noexcept;
+
+    void compute(Program& program);
+
+    /* Computes the liveness unless the cached result is still valid. */
+    void update(Program& program);
+
+    bool isValid(Program const& program) const noexcept;
+    void markValid(Program const& program);
+
+    SparseBitSet& liveIn(Block const& block) noexcept { return liveIn_[block.id()]; }
+    SparseBitSet const& liveIn(Block const& block) const noexcept { return liveIn_[block.id()]; }
+
+    void computeLiveOut(Block& block, ScratchBitSet& ret) const;
+
+  private:
+    std::vector<SparseBitSet> liveIn_;
+    BitSet vgprs_;
+    std::uint64_t version_;
+};
+}
+}
+}
+
+#endif
@@ -9,7 +9,7 @@ using namespace hir;
 void
 lowerInput(Program& program)
 {
-    std::vector<std::unique_ptr<Inst>> params, params2;
+    std::vector<ArenaPtr<Inst>> params, params2;
     ;
     params.push_back(program.createDef<Inst>(OpCode::parameter, &int32Type, 0));
     params.push_back(program.createDef<Inst>(OpCode::parameter, &float32Type, hir::InstFlags::alwaysVarying, 0));
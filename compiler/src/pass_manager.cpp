@@ -0,0 +1,31 @@
+#include "pass_manager.hpp"
+
+#include <iterator>
+
+namespace algrad {
+namespace compiler {
+
+namespace hir {
+std::size_t
+instructionCount(Program& program)
+{
+    auto variables = program.variables();
+    auto count = static_cast<std::size_t>(std::distance(variables.begin(), variables.end()));
+    for (auto& bb : program.basicBlocks())
+        count += static_cast<std::size_t>(std::distance(bb->instructions().begin(), bb->instructions().end()));
+    return count;
+}
+}
+
+namespace lir {
+std::size_t
+instructionCount(Program& program)
+{
+    std::size_t count = 0;
+    for (auto& block : program.blocks())
+        count += block->instructions().size();
+    return count;
+}
+}
+}
+}
@@ -0,0 +1,175 @@
+#ifndef ALGRAD_COMPILER_PASS_MANAGER_HPP
+#define ALGRAD_COMPILER_PASS_MANAGER_HPP
+
+#include <cstddef>
+#include <vector>
+
+#include "dominance.hpp"
+#include "hir.hpp"
+#include "hir_inlines.hpp"
+#include "lir.hpp"
+#include "liveness.hpp"
+#include "pass_timing.hpp"
+
+namespace algrad {
+namespace compiler {
+
+/* Analyses the pass managers cache between passes, one bit each. */
+enum Analysis : unsigned
+{
+    analysisRPO = 1U << 0,
+    analysisDominators = 1U << 1,
+    analysisPostDominators = 1U << 2,
+    analysisDivergence = 1U << 3,
+    analysisLiveness = 1U << 4
+};
+
+using AnalysisSet = unsigned;
+
+enum : AnalysisSet
+{
+    noAnalyses = 0,
+
+    /* Stay valid as long as a pass does not change the control flow graph. */
+    cfgAnalyses = analysisRPO | analysisDominators | analysisPostDominators,
+
+    allAnalyses = ~0U
+};
+
+namespace hir {
+/*
+ * Cached analyses of a HIR program. The block order and ids that make up the
+ * RPO and the divergence flags are stored in the program itself.
+ */
+struct Analyses
+{
+    AnalysisSet valid = noAnalyses;
+    DominatorTree dominators;
+    DominatorTree postDominators;
+};
+
+std::size_t instructionCount(Program& program);
+}
+
+namespace lir {
+struct Analyses
+{
+    AnalysisSet valid = noAnalyses;
+    Liveness liveness;
+};
+
+std::size_t instructionCount(Program& program);
+}
+
+/*
+ * Runs a pipeline of passes over a program. Each pass declares the analyses
+ * it needs, which are computed first unless their cached result is still
+ * valid, and the analyses it preserves; all others are invalidated after it
+ * has run. Computing an analysis invalidates the analyses derived from it.
+ * A pass manager is immutable once built, so compiles on different threads
+ * can share it.
+ */
+template <typename Program, typename Analyses>
+class PassManager
+{
+  public:
+    using Run = void (*)(Program&, Analyses&);
+
+    /* Analyses have to be added after the analyses they require. */
+    void addAnalysis(Analysis analysis, char const* name, AnalysisSet needs, Run compute);
+    void addPass(char const* name, AnalysisSet needs, AnalysisSet preserves, Run run);
+
+    /* Makes sure every analysis in required is valid. */
+    void require(Program& program, Analyses& analyses, AnalysisSet required, PassTimer& timer) const;
+
+    void run(Program& program, Analyses& analyses, PassTimer& timer) const;
+
+  private:
+    struct AnalysisInfo
+    {
+        Analysis analysis;
+        char const* name;
+        AnalysisSet needs;
+        Run compute;
+    };
+
+    struct Pass
+    {
+        char const* name;
+        AnalysisSet needs;
+        AnalysisSet preserves;
+        Run run;
+    };
+
+    static void runTimed(char const* name, Run run, Program& program, Analyses& analyses, PassTimer& timer);
+
+    std::vector<AnalysisInfo> analyses_;
+    std::vector<Pass> passes_;
+};
+
+using HIRPassManager = PassManager<hir::Program, hir::Analyses>;
+using LIRPassManager = PassManager<lir::Program, lir::Analyses>;
+
+template <typename Program, typename Analyses>
+void
+PassManager<Program, Analyses>::addAnalysis(Analysis analysis, char const* name, AnalysisSet needs, Run compute)
+{
+    analyses_.push_back({analysis, name, needs, compute});
+}
+
+template <typename Program, typename Analyses>
+void
+PassManager<Program, Analyses>::addPass(char const* name, AnalysisSet needs, AnalysisSet preserves, Run run)
+{
+    passes_.push_back({name, needs, preserves, run});
+}
+
+template <typename Program, typename Analyses>
+void
+PassManager<Program, Analyses>::require(Program& program, Analyses& analyses, AnalysisSet required,
+                                        PassTimer& timer) const
+{
+    for (auto const& info : analyses_) {
+        if (!(required & info.analysis) || (analyses.valid & info.analysis))
+            continue;
+
+        require(program, analyses, info.needs, timer);
+        runTimed(info.name, info.compute, program, analyses, timer);
+        for (auto const& other : analyses_) {
+            if (other.needs & info.analysis)
+                analyses.valid &= ~static_cast<AnalysisSet>(other.analysis);
+        }
+        analyses.valid |= info.analysis;
+    }
+}
+
+template <typename Program, typename Analyses>
+void
+PassManager<Program, Analyses>::run(Program& program, Analyses& analyses, PassTimer& timer) const
+{
+    for (auto const& pass : passes_) {
+        require(program, analyses, pass.needs, timer);
+        runTimed(pass.name, pass.run, program, analyses, timer);
+        analyses.valid &= pass.preserves;
+    }
+}
+
+template <typename Program, typename Analyses>
+void
+PassManager<Program, Analyses>::runTimed(char const* name, Run run, Program& program, Analyses& analyses,
+                                         PassTimer& timer)
+{
+    if (!timer.enabled()) {
+        run(program, analyses);
+        return;
+    }
+
+    timer.start(name, instructionCount(program), program.arena().allocatedBytes());
+    run(program, analyses);
+    auto allocated = program.arena().allocatedBytes();
+    timer.stop(instructionCount(program), allocated, allocated);
+}
+}
+}
+
+#endif
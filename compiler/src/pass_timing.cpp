@@ -0,0 +1,128 @@
+#include "pass_timing.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <ostream>
+
+namespace algrad {
+namespace compiler {
+
+void
+PassTimings::merge(std::vector<PassStatistics> const& passes)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto const& pass : passes) {
+        auto it = std::find_if(passes_.begin(), passes_.end(),
+                               [&](PassStatistics const& other) { return other.name == pass.name; });
+        if (it == passes_.end()) {
+            passes_.push_back(pass);
+            continue;
+        }
+
+        it->runs += pass.runs;
+        it->seconds += pass.seconds;
+        it->instsBefore += pass.instsBefore;
+        it->instsAfter += pass.instsAfter;
+        it->allocatedBytes += pass.allocatedBytes;
+        it->peakBytes = std::max(it->peakBytes, pass.peakBytes);
+    }
+}
+
+std::vector<PassStatistics>
+PassTimings::passes() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return passes_;
+}
+
+void
+PassTimings::print(std::ostream& os) const
+{
+    auto passes = this->passes();
+    double total = 0.0;
+    std::size_t nameWidth = sizeof("total") - 1;
+    for (auto const& pass : passes) {
+        total += pass.seconds;
+        nameWidth = std::max(nameWidth, pass.name.size());
+    }
+    auto nameColumn = std::setw(static_cast<int>(nameWidth + 2));
+
+    auto flags = os.flags();
+    os << std::left << nameColumn << "pass" << std::right << std::setw(8) << "runs" << std::setw(12) << "ms"
+       << std::setw(8) << "%" << std::setw(14) << "insts in" << std::setw(14) << "insts out" << std::setw(14)
+       << "alloc KiB" << std::setw(12) << "peak KiB"
+       << "\n";
+    os << std::fixed;
+    for (auto const& pass : passes) {
+        os << std::left << nameColumn << pass.name << std::right << std::setw(8) << pass.runs << std::setw(12)
+           << std::setprecision(3) << pass.seconds * 1000.0 << std::setw(8) << std::setprecision(1)
+           << (total > 0.0 ? pass.seconds * 100.0 / total : 0.0) << std::setw(14) << pass.instsBefore << std::setw(14)
+           << pass.instsAfter << std::setw(14) << pass.allocatedBytes / 1024 << std::setw(12) << pass.peakBytes / 1024
+           << "\n";
+    }
+    os << std::left << nameColumn << "total" << std::right << std::setw(20) << std::setprecision(3)
+       << total * 1000.0 << "\n";
+    os.flags(flags);
+}
+
+void
+PassTimings::printJSON(std::ostream& os) const
+{
+    auto passes = this->passes();
+    os << "{\"passes\": [";
+    for (std::size_t i = 0; i < passes.size(); ++i) {
+        auto const& pass = passes[i];
+        os << (i ? ",\n" : "\n") << "  {\"name\": \"" << pass.name << "\", \"runs\": " << pass.runs
+           << ", \"seconds\": " << pass.seconds << ", \"instsBefore\": " << pass.instsBefore
+           << ", \"instsAfter\": " << pass.instsAfter << ", \"allocatedBytes\": " << pass.allocatedBytes
+           << ", \"peakBytes\": " << pass.peakBytes << "}";
+    }
+    os << "\n]}\n";
+}
+
+PassTimer::PassTimer(PassTimings* timings, TraceSink* trace, Hash128 shader)
+  : timings_{timings}, trace_{trace}, shader_{shader}, name_{nullptr}, startAllocated_{0}
+{
+    if (trace_)
+        begin_ = std::chrono::steady_clock::now();
+}
+
+void
+PassTimer::start(char const* name, std::size_t insts, std::size_t allocatedBytes)
+{
+    PassStatistics pass;
+    pass.name = name;
+    pass.runs = 1;
+    pass.instsBefore = insts;
+    passes_.push_back(std::move(pass));
+    name_ = name;
+    startAllocated_ = allocatedBytes;
+    start_ = std::chrono::steady_clock::now();
+}
+
+void
+PassTimer::stop(std::size_t insts, std::size_t allocatedBytes, std::size_t footprint)
+{
+    auto now = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed = now - start_;
+    auto& pass = passes_.back();
+    pass.seconds = elapsed.count();
+    pass.instsAfter = insts;
+    pass.allocatedBytes = allocatedBytes - startAllocated_;
+    pass.peakBytes = footprint;
+    if (trace_)
+        trace_->addSpan("pass", name_, start_, now, shader_);
+}
+
+void
+PassTimer::finish()
+{
+    if (timings_)
+        timings_->merge(passes_);
+    if (trace_)
+        trace_->addSpan("shader", "compile", begin_, std::chrono::steady_clock::now(), shader_);
+    passes_.clear();
+}
+}
+}
@@ -0,0 +1,91 @@
+#ifndef ALGRAD_COMPILER_PASS_TIMING_HPP
+#define ALGRAD_COMPILER_PASS_TIMING_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "hash.hpp"
+
+namespace algrad {
+namespace compiler {
+
+struct PassStatistics
+{
+    std::string name;
+    std::uint64_t runs = 0;
+    double seconds = 0.0;
+
+    /* Summed over all runs. */
+    std::uint64_t instsBefore = 0;
+    std::uint64_t instsAfter = 0;
+    std::uint64_t allocatedBytes = 0;
+
+    /* The largest IR footprint at the end of any run. */
+    std::uint64_t peakBytes = 0;
+};
+
+/*
+ * Per-pass statistics, aggregated over any number of compiles. Compiles on
+ * different threads can share one instance, each compile merges its own
+ * statistics once it has finished.
+ */
+class PassTimings
+{
+  public:
+    void merge(std::vector<PassStatistics> const& passes);
+
+    std::vector<PassStatistics> passes() const;
+
+    void print(std::ostream& os) const;
+    void printJSON(std::ostream& os) const;
+
+  private:
+    mutable std::mutex mutex_;
+
+    /* In the order the passes first ran. */
+    std::vector<PassStatistics> passes_;
+};
+
+class TraceSink;
+
+/*
+ * Collects the statistics of the passes of a single compile and adds a trace
+ * span for the compile and for every pass. Does nothing without a
+ * PassTimings or a TraceSink.
+ */
+class PassTimer
+{
+  public:
+    PassTimer(PassTimings* timings, TraceSink* trace, Hash128 shader);
+
+    PassTimer(PassTimer const&) = delete;
+    PassTimer& operator=(PassTimer const&) = delete;
+
+    bool enabled() const noexcept { return timings_ || trace_; }
+
+    /* The trace keeps a pointer to the name, so it has to be a string literal. */
+    void start(char const* name, std::size_t insts, std::size_t allocatedBytes);
+    void stop(std::size_t insts, std::size_t allocatedBytes, std::size_t footprint);
+
+    /* Merges the statistics into the PassTimings, passes of failed compiles are never reported. */
+    void finish();
+
+  private:
+    PassTimings* timings_;
+    TraceSink* trace_;
+    Hash128 shader_;
+    std::vector<PassStatistics> passes_;
+    char const* name_;
+    std::chrono::steady_clock::time_point begin_;
+    std::chrono::steady_clock::time_point start_;
+    std::size_t startAllocated_;
+};
+}
+}
+
+#endif
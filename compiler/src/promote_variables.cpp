@@ -1,10 +1,10 @@
+#include "dominance.hpp"
 #include "hir.hpp"
 #include "hir_inlines.hpp"
 
-#include <iostream>
-#include <unordered_map>
-
-#include <boost/range/adaptor/reversed.hpp>
+#include <exception>
+#include <utility>
+#include <vector>
 
 namespace algrad {
 namespace compiler {
@@ -44,10 +44,11 @@ splitVariables(Program& program)
         });
     }
 
-    std::vector<std::unique_ptr<Inst>> toBeDeleted;
+    std::vector<ArenaPtr<Inst>> toBeDeleted;
+    /* The new variables are appended to the list being walked, they have ids past the ones that can be split. */
     for (auto it = program.variables().begin(); it != program.variables().end();) {
         auto& v = *it++;
-        if (canBeSplit[v.id()]) {
+        if (static_cast<std::size_t>(v.id()) < canBeSplit.size() && canBeSplit[v.id()]) {
             newVarOffsets[v.id()] = newVars.size();
             auto type = static_cast<PointerTypeInfo const*>(v.type())->pointeeType();
             auto count = compositeCount(type);
@@ -85,85 +86,243 @@ splitVariables(Program& program)
     return !toBeDeleted.empty();
 }
 
+namespace {
+/* Loads of a variable that was never stored to are undefined, any value will do. */
+Def*
+undefinedValue(Program& program, Type type)
+{
+    if (isComposite(type))
+        std::terminate();
+    return program.getScalarConstant(type, std::uint64_t{0});
+}
+
+/*
+ * Blocks where a phi is needed for a variable: the iterated dominance frontier
+ * of the blocks that store to it, pruned to the blocks where it is live-in.
+ */
+void
+placePhis(Program& program, DominatorTree const& dominators, std::vector<std::vector<int>> const& defBlocks,
+          std::vector<std::vector<int>> const& exposedBlocks, std::vector<std::vector<std::pair<int, Inst*>>>& phis)
+{
+    auto& blocks = program.basicBlocks();
+    std::vector<int> defined(blocks.size(), -1), live(blocks.size(), -1), queued(blocks.size(), -1),
+      placed(blocks.size(), -1);
+    std::vector<int> worklist;
+
+    for (int var = 0; var < static_cast<int>(defBlocks.size()); ++var) {
+        if (defBlocks[var].empty())
+            continue;
+
+        /* A variable is live-in where it is loaded before any store, and upwards from there until a store. */
+        for (auto b : defBlocks[var])
+            defined[b] = var;
+        for (auto b : exposedBlocks[var]) {
+            live[b] = var;
+            worklist.push_back(b);
+        }
+        while (!worklist.empty()) {
+            auto b = worklist.back();
+            worklist.pop_back();
+            for (auto pred : blocks[b]->predecessors()) {
+                if (live[pred->id()] != var && defined[pred->id()] != var) {
+                    live[pred->id()] = var;
+                    worklist.push_back(pred->id());
+                }
+            }
+        }
+
+        for (auto b : defBlocks[var]) {
+            queued[b] = var;
+            worklist.push_back(b);
+        }
+        while (!worklist.empty()) {
+            auto b = worklist.back();
+            worklist.pop_back();
+            for (auto y : dominators.frontier(*blocks[b])) {
+                if (placed[y->id()] == var)
+                    continue;
+                placed[y->id()] = var;
+                if (live[y->id()] == var)
+                    phis[y->id()].push_back({var, nullptr});
+                if (queued[y->id()] != var) {
+                    queued[y->id()] = var;
+                    worklist.push_back(y->id());
+                }
+            }
+        }
+    }
+}
+
+/* Replaces phis whose operands are all the same value or the phi itself, which can make other phis trivial. */
+void
+removeTrivialPhis(Program& program, std::vector<Inst*> worklist)
+{
+    std::vector<ArenaPtr<Inst>> removed;
+    std::vector<bool> isRemoved(program.defIdCount());
+    while (!worklist.empty()) {
+        auto& phi = *worklist.back();
+        worklist.pop_back();
+        if (isRemoved[phi.id()])
+            continue;
+
+        auto same = trivialPhiValue(phi);
+        if (same == &phi)
+            continue;
+
+        if (!same)
+            same = undefinedValue(program, phi.type());
+        for (auto& use : phi.uses()) {
+            auto consumer = use.consumer();
+            if (consumer != &phi && consumer->opCode() == OpCode::phi && !isRemoved[consumer->id()])
+                worklist.push_back(consumer);
+        }
+        replace(phi, *same);
+        isRemoved[phi.id()] = true;
+        removed.push_back(phi.parent()->erase(phi));
+    }
+}
+}
+
+/* The dominator tree works on the ids orderBlocksRPO assigns. */
 void
 promoteVariables(Program& program)
+{
+    orderBlocksRPO(program);
+    DominatorTree dominators;
+    dominators.computeDominators(program);
+    promoteVariables(program, dominators);
+}
+
+/*
+ * Pruned SSA construction: phis are only placed at the iterated dominance
+ * frontier of the stores of a variable, and only where the variable is live.
+ * The loads are then renamed in a walk over the dominator tree. Phis that
+ * turn out to merge a single value are removed afterwards.
+ */
+void
+promoteVariables(Program& program, DominatorTree const& dominators)
 {
     splitVariables(program);
 
-    std::vector<int> canPromote(program.defIdCount(), -1);
-    int idx = 0;
-    for (auto& var : program.variables()) {
-        canPromote[var.id()] = idx++;
-    }
+    std::vector<int> varIndex(program.defIdCount(), -1);
+    std::vector<Inst*> vars;
+    for (auto& var : program.variables())
+        varIndex[var.id()] = 0;
 
     for (auto& bb : program.basicBlocks()) {
-        visitInstructions(*bb, [&canPromote](Inst& insn) {
+        visitInstructions(*bb, [&varIndex](Inst& insn) {
             if (insn.opCode() == OpCode::store)
-                canPromote[insn.getOperand(1)->id()] = -1;
+                varIndex[insn.getOperand(1)->id()] = -1;
             else if (insn.opCode() != OpCode::load) {
                 auto operandCount = insn.operandCount();
                 for (std::size_t j = 0; j < operandCount; ++j) {
-                    canPromote[insn.getOperand(j)->id()] = -1;
+                    varIndex[insn.getOperand(j)->id()] = -1;
                 }
             }
         });
     }
-
-    std::unordered_map<hir::BasicBlock*, std::vector<hir::Def*>> defsOut;
-    for (auto& bb : program.basicBlocks()) {
-        std::vector<hir::Def*> promotedValues(idx);
-
-        if (!bb->predecessors().empty())
-            promotedValues = defsOut[bb->predecessors()[0]];
-        std::vector<std::unique_ptr<hir::Inst>> phis;
-        if (bb->predecessors().size() > 1) {
-            auto it = program.variables().begin();
-            for (std::size_t i = 0; i < promotedValues.size(); ++i, ++it) {
-                phis.push_back(program.createDef<Inst>(OpCode::phi,
-                                                       static_cast<PointerTypeInfo const*>(it->type())->pointeeType(),
-                                                       bb->predecessors().size()));
-
-                promotedValues[i] = phis.back().get();
-            }
+    for (auto& var : program.variables()) {
+        if (varIndex[var.id()] >= 0) {
+            varIndex[var.id()] = vars.size();
+            vars.push_back(&var);
         }
-        for (auto it = bb->instructions().begin(); it != bb->instructions().end();) {
-            auto& insn = *it++;
+    }
+
+    auto promoted = [&](Inst& insn) {
+        if (insn.opCode() != OpCode::load && insn.opCode() != OpCode::store)
+            return -1;
+        auto id = insn.getOperand(0)->id();
+        return id < static_cast<int>(varIndex.size()) ? varIndex[id] : -1;
+    };
+
+    /* The blocks storing to each variable and the blocks loading it before any store. */
+    auto& blocks = program.basicBlocks();
+    std::vector<std::vector<int>> defBlocks(vars.size()), exposedBlocks(vars.size());
+    std::vector<int> stored(vars.size(), -1), exposed(vars.size(), -1);
+    for (auto& bb : blocks) {
+        for (auto& insn : bb->instructions()) {
+            auto var = promoted(insn);
+            if (var < 0 || stored[var] == bb->id())
+                continue;
             if (insn.opCode() == OpCode::store) {
-                auto baseId = insn.getOperand(0)->id();
-                if (canPromote[baseId] >= 0) {
-                    promotedValues[canPromote[baseId]] = insn.getOperand(1);
-                    bb->erase(insn);
-                }
-            } else if (insn.opCode() == OpCode::load) {
-                auto baseId = insn.getOperand(0)->id();
-                if (canPromote[baseId] >= 0) {
-                    replace(insn, *promotedValues[canPromote[baseId]]);
-                    bb->erase(insn);
-                }
+                stored[var] = bb->id();
+                defBlocks[var].push_back(bb->id());
+            } else if (exposed[var] != bb->id()) {
+                exposed[var] = bb->id();
+                exposedBlocks[var].push_back(bb->id());
             }
         }
+    }
 
-        for (auto& insn : boost::adaptors::reverse(phis)) {
-            bb->insertFront(std::move(insn));
-        }
+    std::vector<std::vector<std::pair<int, Inst*>>> phis(blocks.size());
+    placePhis(program, dominators, defBlocks, exposedBlocks, phis);
 
-        defsOut[bb.get()] = promotedValues;
+    std::vector<Inst*> createdPhis;
+    for (auto& bb : blocks) {
+        auto& blockPhis = phis[bb->id()];
+        for (auto it = blockPhis.rbegin(); it != blockPhis.rend(); ++it) {
+            auto type = static_cast<PointerTypeInfo const*>(vars[it->first]->type())->pointeeType();
+            it->second = &bb->insertFront(program.createDef<Inst>(OpCode::phi, type, bb->predecessors().size()));
+            createdPhis.push_back(it->second);
+        }
     }
-    for (auto& bb : program.basicBlocks()) {
-        auto& defs = defsOut[bb.get()];
-        for (auto succ : bb->successors()) {
-            if (succ->predecessors().size() <= 1)
+
+    /*
+     * Rename in a walk over the dominator tree, so the current value of every
+     * variable at the start of a block is the one at the end of its immediate
+     * dominator. Changes are logged to restore the values when leaving a
+     * subtree. Unreachable blocks are not in the tree and are walked on their
+     * own, starting without any values.
+     */
+    std::vector<Def*> current(vars.size());
+    std::vector<std::pair<int, Def*>> log;
+    auto valueOf = [&](int var) {
+        if (!current[var])
+            current[var] = undefinedValue(
+              program, static_cast<PointerTypeInfo const*>(vars[var]->type())->pointeeType());
+        return current[var];
+    };
+    auto assign = [&](int var, Def* value) {
+        log.push_back({var, current[var]});
+        current[var] = value;
+    };
+
+    std::vector<std::size_t> logSizes;
+    auto enter = [&](BasicBlock& bb) {
+        logSizes.push_back(log.size());
+        for (auto& phi : phis[bb.id()])
+            assign(phi.first, phi.second);
+
+        for (auto it = bb.instructions().begin(); it != bb.instructions().end();) {
+            auto& insn = *it++;
+            auto var = promoted(insn);
+            if (var < 0)
                 continue;
-            unsigned idx = 0;
-            while (succ->predecessors()[idx] != bb.get())
-                ++idx;
+            if (insn.opCode() == OpCode::store)
+                assign(var, insn.getOperand(1));
+            else
+                replace(insn, *valueOf(var));
+            bb.erase(insn);
+        }
 
-            auto it = succ->instructions().begin();
-            for (std::size_t i = 0; i < defs.size(); ++i, ++it) {
-                it->setOperand(idx, defs[i]);
+        for (auto succ : bb.successors()) {
+            auto& preds = succ->predecessors();
+            for (std::size_t i = 0; i < preds.size(); ++i) {
+                if (preds[i] != &bb)
+                    continue;
+                for (auto& phi : phis[succ->id()])
+                    phi.second->setOperand(i, valueOf(phi.first));
             }
         }
-    }
+    };
+    auto leave = [&](BasicBlock&) {
+        for (; log.size() > logSizes.back(); log.pop_back())
+            current[log.back().first] = log.back().second;
+        logSizes.pop_back();
+    };
+    dominators.walk(program, enter, leave);
+
+    removeTrivialPhis(program, std::move(createdPhis));
 
     for (auto it = program.variables().begin(); it != program.variables().end();) {
         auto& v = *it++;
@@ -1,96 +1,29 @@
+#include "bit_set.hpp"
 #include "lir.hpp"
+#include "liveness.hpp"
 
+#include <array>
 #include <iostream>
 #include <unordered_map>
-#include <unordered_set>
 
 #include <boost/range/adaptor/reversed.hpp>
 
 namespace algrad {
 namespace compiler {
 
-using Live_set = std::unordered_set<unsigned>;
-
-Live_set
-get_live_out(std::vector<Live_set>& liveIn, lir::Program const& program, lir::Block& bb)
-{
-    Live_set ret;
-    for (int logical = 0; logical < 2; ++logical) {
-        for (auto succ : (logical ? bb.logicalSuccessors() : bb.linearizedSuccessors())) {
-            for (auto e : liveIn[succ->id()])
-                if ((logical && program.temp_info(e).reg_class == lir::RegClass::vgpr) ||
-                    (!logical && program.temp_info(e).reg_class != lir::RegClass::vgpr))
-                    ret.insert(e);
-            int index = -1;
-            unsigned i = 0;
-            for (auto pred : (logical ? succ->logicalPredecessors() : succ->linearizedPredecessors())) {
-                if (pred == &bb)
-                    index = i;
-                ++i;
-            }
-
-            for (auto& insn : succ->instructions()) {
-                if (insn->opCode() != lir::OpCode::phi)
-                    break;
-                auto reg_class = program.temp_info(insn->getDefinition(0).temp()).reg_class;
-                if ((logical && reg_class == lir::RegClass::vgpr) || (!logical && reg_class != lir::RegClass::vgpr))
-                    ret.insert(insn->getOperand(index).temp());
-            }
-        }
-    }
-    return ret;
-}
-std::vector<Live_set>
-compute_live_in(lir::Program& program)
-{
-    std::vector<Live_set> live_in(program.blocks().size());
-
-    for (;;) {
-        bool changed = false;
-        for (auto& bb : boost::adaptors::reverse(program.blocks())) {
-            auto live = get_live_out(live_in, program, *bb);
-            for (auto& insn : boost::adaptors::reverse(bb->instructions())) {
-                auto defCount = insn->definitionCount();
-                for (unsigned i = 0; i < defCount; ++i) {
-                    auto it = live.find(insn->getDefinition(i).temp());
-                    if (it != live.end())
-                        live.erase(it);
-                }
-
-                if (insn->opCode() != lir::OpCode::phi) {
-                    auto op_count = insn->operandCount();
-                    for (unsigned i = 0; i < op_count; ++i) {
-                        if (insn->getOperand(i).is_temp()) {
-                            insn->getOperand(i).setKill(live.find(insn->getOperand(i).temp()) == live.end());
-                        }
-                    }
-                    for (unsigned i = 0; i < op_count; ++i) {
-                        if (insn->getOperand(i).is_temp()) {
-                            if (live.find(insn->getOperand(i).temp()) == live.end())
-                                live.insert(insn->getOperand(i).temp());
-                        }
-                    }
-                }
-            }
-            if (live != live_in[bb->id()]) {
-                live_in[bb->id()] = live;
-                changed = true;
-            }
-        }
-        if (!changed)
-            break;
-    }
-    return live_in;
-}
-
+/*
+ * The copies redefine the temps they copy, so the live-in sets stay the same and only the
+ * kill flags of the new operands have to be set.
+ */
 void
-insert_copies(lir::Program& program)
+insert_copies(lir::Program& program, lir::Liveness& liveness)
 {
-    auto live_in = compute_live_in(program);
+    liveness.update(program);
+    ScratchBitSet live(program.allocated_temp_count());
     for (auto& bb : program.blocks()) {
-        std::vector<std::unique_ptr<lir::Inst>> instructions;
+        auto instructions = program.createInstVector();
         instructions.reserve(bb->instructions().size());
-        auto live = get_live_out(live_in, program, *bb);
+        liveness.computeLiveOut(*bb, live);
 
         for (auto it = bb->instructions().end(); it != bb->instructions().begin();) {
             --it;
@@ -101,9 +34,7 @@ insert_copies(lir::Program& program)
                 auto const& def = insn->getDefinition(i);
                 if (def.is_temp() && def.isFixed())
                     need_move = true;
-                auto it = live.find(def.temp());
-                if (it != live.end())
-                    live.erase(it);
+                live.reset(def.temp());
             }
 
             auto op_count = insn->operandCount();
@@ -112,19 +43,21 @@ insert_copies(lir::Program& program)
                 if (arg.is_temp()) {
                     if (arg.isFixed())
                         need_move = true;
-                    live.insert(arg.temp());
+                    live.set(arg.temp());
                 }
             }
 
             instructions.push_back(std::move(insn));
             if (need_move && !live.empty()) {
-                auto copy = std::make_unique<lir::Inst>(lir::OpCode::parallel_copy, live.size(), live.size());
+                auto live_count = live.count();
+                auto copy = program.createInst(lir::OpCode::parallel_copy, live_count, live_count);
                 unsigned idx = 0;
-                for (auto e : live) {
+                live.forEach([&](unsigned e) {
                     copy->getOperand(idx) = lir::Arg{e};
+                    copy->getOperand(idx).setKill(true);
                     copy->getDefinition(idx) = lir::Arg{e};
                     ++idx;
-                }
+                });
                 instructions.push_back(std::move(copy));
             }
         }
@@ -132,17 +65,38 @@ insert_copies(lir::Program& program)
         std::reverse(instructions.begin(), instructions.end());
         bb->instructions() = std::move(instructions);
     }
+    program.markModified();
+    liveness.markValid(program);
+}
+
+bool
+in_rename_class(lir::Program const& program, unsigned id, bool logical)
+{
+    return logical == (program.temp_info(id).reg_class == lir::RegClass::vgpr);
 }
 
+/* Translates the live-in set of the block to the temps reaching it, so the liveness stays valid. */
 void
-fix_ssa_rename_visit(lir::Program& program, lir::Block& block, std::vector<bool>& visited,
-                     std::vector<unsigned>& renames, std::vector<std::pair<unsigned, unsigned>>& undo, bool logical)
+fix_ssa_rename_live_in(lir::Program& program, lir::Block& block, lir::Liveness& liveness,
+                       std::vector<unsigned> const& renames, ScratchBitSet& scratch, bool logical)
 {
-    if (visited[block.id()])
-        return;
-    visited[block.id()] = true;
+    scratch.reserve(program.allocated_temp_count());
+    scratch.clear();
+    liveness.liveIn(block).forEach([&](unsigned id) {
+        if (id < renames.size() && in_rename_class(program, id, logical) && renames[id] != ~0U)
+            scratch.set(renames[id]);
+        else
+            scratch.set(id);
+    });
+    scratch.storeTo(liveness.liveIn(block));
+}
+
+void
+fix_ssa_rename_block(lir::Program& program, lir::Block& block, lir::Liveness& liveness, std::vector<unsigned>& renames,
+                     std::vector<std::pair<unsigned, unsigned>>& undo, ScratchBitSet& scratch, bool logical)
+{
+    fix_ssa_rename_live_in(program, block, liveness, renames, scratch, logical);
 
-    auto undo_size = undo.size();
     for (auto& insn : block.instructions()) {
         if (insn->opCode() != lir::OpCode::phi) {
             auto op_count = insn->operandCount();
@@ -191,68 +145,221 @@ fix_ssa_rename_visit(lir::Program& program, lir::Block& block, std::vector<bool>
             inst->getOperand(index).set_temp(renames[id]);
         }
     }
+}
 
-    if (logical) {
-        for (auto succ : block.logicalSuccessors())
-            fix_ssa_rename_visit(program, *succ, visited, renames, undo, logical);
-    } else {
-        for (auto succ : block.linearizedSuccessors())
-            fix_ssa_rename_visit(program, *succ, visited, renames, undo, logical);
-    }
+/*
+ * Renames along a depth-first walk over the logical or linearized edges. The walk keeps an
+ * explicit stack so long chains of blocks do not exhaust the native stack; the renames made in
+ * a block are undone when the walk leaves it.
+ */
+void
+fix_ssa_rename_visit(lir::Program& program, lir::Block& root, lir::Liveness& liveness, std::vector<bool>& visited,
+                     std::vector<unsigned>& renames, std::vector<std::pair<unsigned, unsigned>>& undo,
+                     ScratchBitSet& scratch, bool logical)
+{
+    struct Frame
+    {
+        lir::Block* block;
+        std::size_t next_succ;
+        std::size_t undo_size;
+    };
+    std::vector<Frame> stack;
+
+    auto enter = [&](lir::Block& block) {
+        visited[block.id()] = true;
+        stack.push_back({&block, 0, undo.size()});
+        fix_ssa_rename_block(program, block, liveness, renames, undo, scratch, logical);
+    };
+
+    if (!visited[root.id()])
+        enter(root);
+    while (!stack.empty()) {
+        auto& frame = stack.back();
+        auto& succs = logical ? frame.block->logicalSuccessors() : frame.block->linearizedSuccessors();
+        if (frame.next_succ < succs.size()) {
+            auto succ = succs[frame.next_succ++];
+            if (!visited[succ->id()])
+                enter(*succ);
+            continue;
+        }
 
-    for (std::size_t i = undo.size(); i > undo_size; --i) {
-        renames[undo[i - 1].first] = undo[i - 1].second;
-    }
+        for (std::size_t i = undo.size(); i > frame.undo_size; --i) {
+            renames[undo[i - 1].first] = undo[i - 1].second;
+        }
 
-    undo.resize(undo_size);
+        undo.resize(frame.undo_size);
+        stack.pop_back();
+    }
 }
 
 void
-fix_ssa_rename(lir::Program& program)
+fix_ssa_rename(lir::Program& program, lir::Liveness& liveness)
 {
+    liveness.update(program);
     std::vector<bool> visited(program.blocks().size());
     std::vector<unsigned> renames(program.allocated_temp_count(), ~0U);
     std::vector<std::pair<unsigned, unsigned>> undo;
-    fix_ssa_rename_visit(program, *program.blocks()[0], visited, renames, undo, false);
+    ScratchBitSet scratch(program.allocated_temp_count());
+    fix_ssa_rename_visit(program, *program.blocks()[0], liveness, visited, renames, undo, scratch, false);
     std::fill(visited.begin(), visited.end(), false);
     std::fill(renames.begin(), renames.end(), ~0U);
-    fix_ssa_rename_visit(program, *program.blocks()[0], visited, renames, undo, true);
+    fix_ssa_rename_visit(program, *program.blocks()[0], liveness, visited, renames, undo, scratch, true);
+    program.markModified();
+    liveness.markValid(program);
+}
+void
+fix_ssa(lir::Program& program, lir::Liveness& liveness)
+{
+    fix_ssa_rename(program, liveness);
 }
+/*
+ * Bitmap of the register file in bytes, SGPRs first and VGPRs from vgpr_base. Registers can
+ * additionally be reserved while choosing the register of a single definition.
+ */
+class Register_file
+{
+  public:
+    enum
+    {
+        vgpr_base = 1024,
+        size = 2048,
+        word_count = size / BitSet::wordBits
+    };
+
+    Register_file() noexcept { clear(); }
+
+    void clear() noexcept;
+
+    bool is_free(unsigned reg, unsigned size) const noexcept;
+    void fill(unsigned reg, unsigned size) noexcept;
+    void release(unsigned reg, unsigned size) noexcept;
+
+    void reserve(unsigned reg, unsigned size) noexcept;
+    void clear_reserved() noexcept;
+
+    /* Returns the first free run of size registers in [begin, end) aligned to size, or -1. */
+    int find_free(unsigned begin, unsigned end, unsigned size) const noexcept;
+
+  private:
+    template <typename F>
+    static void for_each_word(unsigned reg, unsigned size, F&& callback);
+
+    std::array<BitSet::Word, word_count> used_;
+    std::array<BitSet::Word, word_count> reserved_;
+    bool has_reserved_;
+};
+
+template <typename F>
+void
+Register_file::for_each_word(unsigned reg, unsigned size, F&& callback)
+{
+    assert(reg + size <= Register_file::size);
+    while (size) {
+        auto bit = reg % BitSet::wordBits;
+        auto count = std::min<unsigned>(size, BitSet::wordBits - bit);
+        auto mask = count == BitSet::wordBits ? ~BitSet::Word{0} : ((BitSet::Word{1} << count) - 1) << bit;
+        callback(reg / BitSet::wordBits, mask);
+        reg += count;
+        size -= count;
+    }
+}
+
 void
-fix_ssa(lir::Program& program)
+Register_file::clear() noexcept
 {
-    fix_ssa_rename(program);
+    used_.fill(0);
+    reserved_.fill(0);
+    has_reserved_ = false;
 }
+
 bool
-allowed(std::vector<bool> const& forbidden, unsigned index, unsigned size)
+Register_file::is_free(unsigned reg, unsigned size) const noexcept
+{
+    bool ret = true;
+    for_each_word(reg, size, [&](unsigned word, BitSet::Word mask) {
+        if ((used_[word] | reserved_[word]) & mask)
+            ret = false;
+    });
+    return ret;
+}
+
+void
+Register_file::fill(unsigned reg, unsigned size) noexcept
+{
+    for_each_word(reg, size, [&](unsigned word, BitSet::Word mask) { used_[word] |= mask; });
+}
+
+void
+Register_file::release(unsigned reg, unsigned size) noexcept
+{
+    for_each_word(reg, size, [&](unsigned word, BitSet::Word mask) { used_[word] &= ~mask; });
+}
+
+void
+Register_file::reserve(unsigned reg, unsigned size) noexcept
 {
-    for (unsigned i = 0; i < size; ++i)
-        if (forbidden[i + index])
-            return false;
-    return true;
+    has_reserved_ = true;
+    for_each_word(reg, size, [&](unsigned word, BitSet::Word mask) { reserved_[word] |= mask; });
 }
 
 void
-set_forbidden(std::vector<bool>& forbidden, unsigned index, unsigned size, bool value)
+Register_file::clear_reserved() noexcept
 {
-    for (unsigned i = 0; i < size; ++i)
-        forbidden[i + index] = value;
+    if (has_reserved_) {
+        reserved_.fill(0);
+        has_reserved_ = false;
+    }
+}
+
+int
+Register_file::find_free(unsigned begin, unsigned end, unsigned size) const noexcept
+{
+    assert(size && begin % BitSet::wordBits == 0 && end <= Register_file::size);
+
+    /* Bit i of starts ends up set iff the size registers from i on are free, by doubling the run length. */
+    std::array<BitSet::Word, word_count> starts;
+    for (unsigned i = 0; i < word_count; ++i)
+        starts[i] = ~(used_[i] | reserved_[i]);
+    for (unsigned have = 1; have < size;) {
+        auto shift = std::min(have, size - have);
+        auto word_shift = shift / BitSet::wordBits, bit_shift = shift % BitSet::wordBits;
+        for (unsigned i = 0; i < word_count; ++i) {
+            auto lo = i + word_shift < word_count ? starts[i + word_shift] : 0;
+            auto hi = i + word_shift + 1 < word_count ? starts[i + word_shift + 1] : 0;
+            starts[i] &= bit_shift ? (lo >> bit_shift) | (hi << (BitSet::wordBits - bit_shift)) : lo;
+        }
+        have += shift;
+    }
+
+    BitSet::Word alignment = ~BitSet::Word{0};
+    if (size <= BitSet::wordBits && !(size & (size - 1))) {
+        alignment = 0;
+        for (unsigned i = 0; i < BitSet::wordBits; i += size)
+            alignment |= BitSet::Word{1} << i;
+    }
+
+    for (unsigned i = begin / BitSet::wordBits; i * BitSet::wordBits < end; ++i) {
+        for (auto w = starts[i] & alignment; w; w &= w - 1) {
+            auto reg = i * BitSet::wordBits + countTrailingZeros(w);
+            if (reg + size > end)
+                return -1;
+            if ((reg - begin) % size == 0)
+                return reg;
+        }
+    }
+    return -1;
 }
 
 std::vector<int>
-color_registers(lir::Program& program)
+color_registers(lir::Program& program, lir::Liveness& liveness)
 {
-    std::vector<std::unordered_set<unsigned>> ig(program.allocated_temp_count());
     std::vector<int> colors(program.allocated_temp_count(), -1);
-    auto live_in = compute_live_in(program);
+    liveness.update(program);
+    Register_file regs;
 
     for (auto& bb : program.blocks()) {
-        std::vector<bool> colors_used(2048);
-        for (auto e : live_in[bb->id()]) {
-            auto size = program.temp_info(e).size;
-            for (std::size_t i = 0; i < size; ++i)
-                colors_used[colors[e] + i] = true;
-        }
+        regs.clear();
+        liveness.liveIn(*bb).forEach([&](unsigned e) { regs.fill(colors[e], program.temp_info(e).size); });
         for (auto it = bb->instructions().begin(); it != bb->instructions().end(); ++it) {
             if ((*it)->opCode() != lir::OpCode::phi) {
                 auto op_count = (*it)->operandCount();
@@ -260,7 +367,7 @@ color_registers(lir::Program& program)
                     auto& arg = (*it)->getOperand(i);
                     if (arg.is_temp()) {
                         if (arg.kill()) {
-                            set_forbidden(colors_used, colors[arg.temp()], program.temp_info(arg.temp()).size, false);
+                            regs.release(colors[arg.temp()], program.temp_info(arg.temp()).size);
                         }
                         arg.setFixed(lir::PhysReg{static_cast<unsigned>(colors[arg.temp()])});
                     }
@@ -271,7 +378,6 @@ color_registers(lir::Program& program)
             for (std::size_t i = 0; i < def_count; ++i) {
                 auto& def = (*it)->getDefinition(i);
                 if (colors[def.temp()] < 0) {
-                    std::vector<bool> forbidden = colors_used;
                     int c = -1;
                     if (def.isFixed()) {
                         c = def.physReg().reg;
@@ -282,8 +388,7 @@ color_registers(lir::Program& program)
                             auto const& arg2 = it[1]->getOperand(j);
                             if (arg2.isFixed()) {
                                 if (def.temp() != arg2.temp())
-                                    set_forbidden(forbidden, arg2.physReg().reg, program.temp_info(arg2.temp()).size,
-                                                  true);
+                                    regs.reserve(arg2.physReg().reg, program.temp_info(arg2.temp()).size);
                                 else
                                     c = arg2.physReg().reg;
                             }
@@ -294,7 +399,7 @@ color_registers(lir::Program& program)
                         if (prev_arg.temp() && !prev_arg.kill()) {
                             std::cerr << prev_arg.temp() << " has no kill\n";
                         }
-                        if (allowed(forbidden, prev_arg.physReg().reg, program.temp_info(prev_arg.temp()).size)) {
+                        if (regs.is_free(prev_arg.physReg().reg, program.temp_info(prev_arg.temp()).size)) {
                             c = prev_arg.physReg().reg;
                         } else
                             std::cerr << "preferred move failed for " << def.temp() << " " << prev_arg.temp() << "\n";
@@ -306,18 +411,23 @@ color_registers(lir::Program& program)
                             if ((*it)->getOperand(j).is_temp() && colors[(*it)->getOperand(j).temp()] >= 0)
                                 candidate = colors[(*it)->getOperand(j).temp()];
                         }
-                        if (candidate >= 0 && allowed(forbidden, candidate, program.temp_info(def.temp()).size)) {
+                        if (candidate >= 0 && regs.is_free(candidate, program.temp_info(def.temp()).size)) {
                             c = candidate;
                         }
                     }
 
                     if (c == -1) {
-                        c = program.temp_info(def.temp()).reg_class == lir::RegClass::vgpr ? 1024 : 0;
-                        while (!allowed(forbidden, c, program.temp_info(def.temp()).size))
-                            c += program.temp_info(def.temp()).size;
+                        if (program.temp_info(def.temp()).reg_class == lir::RegClass::vgpr)
+                            c = regs.find_free(Register_file::vgpr_base, Register_file::size,
+                                               program.temp_info(def.temp()).size);
+                        else
+                            c = regs.find_free(0, Register_file::vgpr_base, program.temp_info(def.temp()).size);
+                        if (c < 0)
+                            std::terminate();
                     }
 
-                    set_forbidden(colors_used, c, program.temp_info(def.temp()).size, true);
+                    regs.clear_reserved();
+                    regs.fill(c, program.temp_info(def.temp()).size);
                     colors[def.temp()] = c;
                 }
                 def.setFixed(lir::PhysReg{static_cast<unsigned>(colors[def.temp()])});
@@ -382,7 +492,7 @@ destroy_phis(lir::Program& program)
         if (args.empty())
             continue;
 
-        auto inst = std::make_unique<lir::Inst>(lir::OpCode::parallel_copy, args.size(), args.size());
+        auto inst = program.createInst(lir::OpCode::parallel_copy, args.size(), args.size());
         for (std::size_t i = 0; i < args.size(); ++i) {
             inst->getOperand(i) = args[i].first;
             inst->getDefinition(i) = args[i].second;
@@ -403,10 +513,18 @@ destroy_phis(lir::Program& program)
 void
 allocateRegisters(lir::Program& program)
 {
-    insert_copies(program);
-    fix_ssa(program);
-    color_registers(program);
+    lir::Liveness liveness;
+    allocateRegisters(program, liveness);
+}
+
+void
+allocateRegisters(lir::Program& program, lir::Liveness& liveness)
+{
+    insert_copies(program, liveness);
+    fix_ssa(program, liveness);
+    color_registers(program, liveness);
     destroy_phis(program);
+    program.markModified();
 }
 }
 }
@@ -0,0 +1,225 @@
+#include "shader_archive.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace algrad {
+namespace compiler {
+
+struct ShaderArchive::Header
+{
+    std::uint32_t magic;
+    std::uint32_t version;
+    std::uint64_t entryCount;
+    std::uint64_t slotCount;
+    std::uint64_t indexOffset;
+};
+
+/*
+ * The code starts at block * blobAlignment. Empty slots have a zero size, as
+ * every compiled shader has at least an s_endpgm.
+ */
+struct ShaderArchive::Slot
+{
+    Hash128 key;
+    std::uint32_t block;
+    std::uint32_t size;
+};
+
+namespace {
+enum : std::uint32_t
+{
+    archiveMagic = 0x41474c41, /* "ALGA" */
+    archiveVersion = 2,
+    blobAlignment = 256
+};
+
+std::uint64_t
+alignToBlob(std::uint64_t offset) noexcept
+{
+    return (offset + blobAlignment - 1) & ~std::uint64_t{blobAlignment - 1};
+}
+
+std::uint64_t
+slotHash(Hash128 key) noexcept
+{
+    /* The keys are already hashes. */
+    return key.low;
+}
+
+struct KeyHash
+{
+    std::size_t operator()(Hash128 key) const noexcept { return key.low; }
+};
+}
+
+ShaderArchive::ShaderArchive() noexcept : mapping_{nullptr}, mappingSize_{0}
+{
+}
+
+ShaderArchive::~ShaderArchive() noexcept
+{
+    close();
+}
+
+bool
+ShaderArchive::open(std::string const& path)
+{
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) || static_cast<std::size_t>(st.st_size) < sizeof(Header)) {
+        ::close(fd);
+        return false;
+    }
+
+    auto mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+        return false;
+
+    mapping_ = mapping;
+    mappingSize_ = st.st_size;
+
+    auto h = header();
+    auto slotCount = h->slotCount;
+    if (h->magic != archiveMagic || h->version != archiveVersion || !slotCount || (slotCount & (slotCount - 1)) ||
+        h->indexOffset % alignof(Slot) || h->indexOffset > mappingSize_ ||
+        slotCount > (mappingSize_ - h->indexOffset) / sizeof(Slot)) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void
+ShaderArchive::close() noexcept
+{
+    if (mapping_)
+        munmap(const_cast<void*>(mapping_), mappingSize_);
+    mapping_ = nullptr;
+    mappingSize_ = 0;
+}
+
+ShaderArchive::Header const*
+ShaderArchive::header() const noexcept
+{
+    return static_cast<Header const*>(mapping_);
+}
+
+std::size_t
+ShaderArchive::size() const noexcept
+{
+    return mapping_ ? header()->entryCount : 0;
+}
+
+ShaderArchive::Code
+ShaderArchive::lookup(Hash128 key) const noexcept
+{
+    if (!mapping_)
+        return {nullptr, 0};
+
+    auto h = header();
+    auto slots = reinterpret_cast<Slot const*>(static_cast<char const*>(mapping_) + h->indexOffset);
+    auto mask = h->slotCount - 1;
+
+    /* A corrupt index may not have an empty slot, so stop after probing all of them. */
+    auto i = slotHash(key) & mask;
+    for (std::uint64_t probes = 0; probes < h->slotCount; ++probes, i = (i + 1) & mask) {
+        auto const& slot = slots[i];
+        if (!slot.size)
+            return {nullptr, 0};
+        if (slot.key == key) {
+            std::uint64_t offset = std::uint64_t{slot.block} * blobAlignment;
+            if (offset > mappingSize_ || slot.size > (mappingSize_ - offset) / sizeof(std::uint32_t))
+                return {nullptr, 0};
+            return {reinterpret_cast<std::uint32_t const*>(static_cast<char const*>(mapping_) + offset), slot.size};
+        }
+    }
+    return {nullptr, 0};
+}
+
+void
+ShaderArchiveWriter::add(Hash128 key, std::vector<std::uint32_t> const& code)
+{
+    entries_.emplace_back(key, code);
+}
+
+bool
+ShaderArchiveWriter::write(std::string const& path) const
+{
+    using Header = ShaderArchive::Header;
+    using Slot = ShaderArchive::Slot;
+
+    std::unordered_map<Hash128, std::size_t, KeyHash> latest;
+    for (std::size_t i = 0; i < entries_.size(); ++i) {
+        if (entries_[i].second.empty())
+            return false;
+        latest[entries_[i].first] = i;
+    }
+
+    std::uint64_t slotCount = 1;
+    while (slotCount < latest.size() * 2)
+        slotCount *= 2;
+
+    Header header{archiveMagic, archiveVersion, latest.size(), slotCount, blobAlignment};
+    std::vector<Slot> slots(slotCount, Slot{{0, 0}, 0, 0});
+
+    auto offset = alignToBlob(header.indexOffset + slotCount * sizeof(Slot));
+    std::vector<std::size_t> order;
+    for (std::size_t i = 0; i < entries_.size(); ++i) {
+        if (latest[entries_[i].first] != i)
+            continue;
+        auto const& code = entries_[i].second;
+        auto mask = slotCount - 1;
+        auto s = slotHash(entries_[i].first) & mask;
+        while (slots[s].size)
+            s = (s + 1) & mask;
+        slots[s] = Slot{entries_[i].first, static_cast<std::uint32_t>(offset / blobAlignment),
+                        static_cast<std::uint32_t>(code.size())};
+        order.push_back(i);
+        offset = alignToBlob(offset + code.size() * sizeof(std::uint32_t));
+    }
+    if (offset / blobAlignment > ~std::uint32_t{0})
+        return false;
+
+    auto tempPath = path + ".tmp" + std::to_string(getpid());
+    auto file = std::fopen(tempPath.c_str(), "wb");
+    if (!file)
+        return false;
+
+    static char const padding[blobAlignment] = {};
+    std::uint64_t written = 0;
+    auto put = [&](void const* data, std::size_t size) {
+        if (size && std::fwrite(data, 1, size, file) != size)
+            return false;
+        written += size;
+        return true;
+    };
+    auto align = [&]() { return put(padding, (blobAlignment - written % blobAlignment) % blobAlignment); };
+
+    bool ok = put(&header, sizeof(header)) && align() && put(slots.data(), slots.size() * sizeof(Slot)) && align();
+    for (auto i : order) {
+        auto const& code = entries_[i].second;
+        ok = ok && put(code.data(), code.size() * sizeof(std::uint32_t)) && align();
+    }
+    ok = ok && !std::fflush(file) && !fsync(fileno(file));
+    ok = !std::fclose(file) && ok;
+    if (!ok || std::rename(tempPath.c_str(), path.c_str())) {
+        std::remove(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
+}
+}
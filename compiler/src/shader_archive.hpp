@@ -0,0 +1,74 @@
+#ifndef ALGRAD_COMPILER_SHADER_ARCHIVE_HPP
+#define ALGRAD_COMPILER_SHADER_ARCHIVE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "hash.hpp"
+
+namespace algrad {
+namespace compiler {
+
+/*
+ * Single-file archive of precompiled shaders that is mapped into memory
+ * instead of being parsed. The file starts with a header, followed by an
+ * open-addressed hash index with linear probing that is at most half full,
+ * followed by the code of every shader at 256-byte aligned offsets. A lookup
+ * usually touches a single index page and returns a pointer into the mapping.
+ *
+ * Keys are the cache keys computed by ShaderCache::computeKey.
+ */
+class ShaderArchive
+{
+  public:
+    struct Code
+    {
+        std::uint32_t const* data;
+        std::size_t size;
+    };
+
+    ShaderArchive() noexcept;
+    ~ShaderArchive() noexcept;
+
+    ShaderArchive(ShaderArchive const&) = delete;
+    ShaderArchive& operator=(ShaderArchive const&) = delete;
+
+    /* Maps the archive, returns false if the file is missing or not a valid archive. */
+    bool open(std::string const& path);
+    void close() noexcept;
+
+    std::size_t size() const noexcept;
+
+    /* Returns a null Code if the key is not in the archive. */
+    Code lookup(Hash128 key) const noexcept;
+
+  private:
+    struct Header;
+    struct Slot;
+
+    Header const* header() const noexcept;
+
+    void const* mapping_;
+    std::size_t mappingSize_;
+
+    friend class ShaderArchiveWriter;
+};
+
+class ShaderArchiveWriter
+{
+  public:
+    /* Later additions of the same key replace earlier ones. */
+    void add(Hash128 key, std::vector<std::uint32_t> const& code);
+
+    /* Writes a temporary file and renames it to path, returns false on failure. */
+    bool write(std::string const& path) const;
+
+  private:
+    std::vector<std::pair<Hash128, std::vector<std::uint32_t>>> entries_;
+};
+}
+}
+
+#endif
@@ -0,0 +1,222 @@
+#include "shader_cache.hpp"
+#include "spirv_loader.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+namespace algrad {
+namespace compiler {
+
+namespace {
+/* Bump whenever the generated code or the entry format changes, to invalidate existing caches. */
+char const compilerVersionSalt[] = "algrad-compiler cache v2";
+
+struct EntryHeader
+{
+    std::uint32_t magic;
+    std::uint32_t codeSize;
+    Hash128 key;
+};
+
+enum : std::uint32_t
+{
+    entryMagic = 0x43474c41 /* "ALGC" */
+};
+
+bool
+isEntryName(std::string const& name)
+{
+    return name.size() == 36 && !name.compare(32, 4, ".bin");
+}
+
+bool
+isTempName(std::string const& name)
+{
+    return name.size() > 40 && !name.compare(32, 8, ".bin.tmp");
+}
+
+enum : std::int64_t
+{
+    /* Writing an entry takes milliseconds, a temporary file this old belongs to a writer that died. */
+    staleTempSeconds = 10 * 60
+};
+}
+
+ShaderCache::ShaderCache(std::string directory, std::uint64_t maxSize)
+  : directory_{std::move(directory)}, maxSize_{maxSize}, size_{0}, tempCounter_{0}
+{
+    mkdir(directory_.c_str(), 0755);
+
+    if (auto dir = opendir(directory_.c_str())) {
+        while (auto entry = readdir(dir)) {
+            struct stat st;
+            if (isEntryName(entry->d_name) && !stat((directory_ + "/" + entry->d_name).c_str(), &st))
+                size_ += st.st_size;
+        }
+        closedir(dir);
+    }
+}
+
+Hash128
+ShaderCache::computeKey(std::uint32_t const* begin, std::uint32_t const* end, std::string const& entryName,
+                        CompileOptions const& options)
+{
+    /* The optimization level is the only option that changes the generated code. */
+    Hasher128 hasher;
+    hasher.update(std::string(compilerVersionSalt));
+    hasher.update(entryName);
+    hasher.update(static_cast<std::uint64_t>(options.optimizationLevel));
+
+    /* Modules the canonicalizer does not understand are keyed by their raw words instead. */
+    std::vector<std::uint32_t> canonical;
+    bool canonicalized = canonicalizeSPIRV(begin, end, canonical);
+    if (canonicalized) {
+        begin = canonical.data();
+        end = canonical.data() + canonical.size();
+    }
+    hasher.update(static_cast<std::uint64_t>(canonicalized));
+    hasher.update(static_cast<std::uint64_t>(end - begin));
+    hasher.update(begin, (end - begin) * sizeof(std::uint32_t));
+    return hasher.finish();
+}
+
+std::string
+ShaderCache::entryPath(Hash128 key) const
+{
+    char name[48];
+    std::snprintf(name, sizeof(name), "/%016llx%016llx.bin", static_cast<unsigned long long>(key.high),
+                  static_cast<unsigned long long>(key.low));
+    return directory_ + name;
+}
+
+bool
+ShaderCache::lookup(Hash128 key, CompiledShader& shader)
+{
+    auto path = entryPath(key);
+    auto file = std::fopen(path.c_str(), "rb");
+    if (!file)
+        return false;
+
+    /* The size in the header is only trusted once it matches the file, a corrupt one could ask for gigabytes. */
+    EntryHeader header;
+    struct stat st;
+    bool ok = std::fread(&header, sizeof(header), 1, file) == 1 && header.magic == entryMagic && header.key == key &&
+              !fstat(fileno(file), &st) &&
+              static_cast<std::uint64_t>(st.st_size) ==
+                sizeof(header) + std::uint64_t{header.codeSize} * sizeof(std::uint32_t);
+    if (ok) {
+        shader.code.resize(header.codeSize);
+        ok = std::fread(shader.code.data(), sizeof(std::uint32_t), header.codeSize, file) == header.codeSize &&
+             std::fgetc(file) == EOF;
+    }
+    std::fclose(file);
+    if (!ok) {
+        shader.code.clear();
+        return false;
+    }
+
+    /* The modification time doubles as the last use time for the LRU eviction. */
+    utime(path.c_str(), nullptr);
+    return true;
+}
+
+void
+ShaderCache::insert(Hash128 key, CompiledShader const& shader)
+{
+    auto path = entryPath(key);
+    std::string tempPath;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tempPath = path + ".tmp" + std::to_string(getpid()) + "." + std::to_string(tempCounter_++);
+    }
+
+    auto file = std::fopen(tempPath.c_str(), "wb");
+    if (!file)
+        return;
+
+    EntryHeader header{entryMagic, static_cast<std::uint32_t>(shader.code.size()), key};
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+              std::fwrite(shader.code.data(), sizeof(std::uint32_t), shader.code.size(), file) == shader.code.size();
+    ok &= !std::fflush(file) && !fsync(fileno(file));
+    ok &= !std::fclose(file);
+    /* Another thread or process may have inserted the same entry, replacing it does not grow the cache. */
+    struct stat st;
+    bool replaced = !stat(path.c_str(), &st);
+    if (!ok || std::rename(tempPath.c_str(), path.c_str())) {
+        std::remove(tempPath.c_str());
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!replaced)
+        size_ += sizeof(header) + shader.code.size() * sizeof(std::uint32_t);
+    if (size_ > maxSize_)
+        evict();
+}
+
+/*
+ * Removes the least recently used entries until the cache is below three
+ * quarters of its size, and the temporary files of writers that died before
+ * renaming them.
+ */
+void
+ShaderCache::evict()
+{
+    struct Entry
+    {
+        std::string path;
+        std::uint64_t size;
+        struct timespec lastUse;
+    };
+    std::vector<Entry> entries;
+    size_ = 0;
+
+    auto now = time(nullptr);
+    if (auto dir = opendir(directory_.c_str())) {
+        while (auto entry = readdir(dir)) {
+            struct stat st;
+            std::string path = directory_ + "/" + entry->d_name;
+            if (isEntryName(entry->d_name) && !stat(path.c_str(), &st)) {
+                entries.push_back({path, static_cast<std::uint64_t>(st.st_size), st.st_mtim});
+                size_ += st.st_size;
+            } else if (isTempName(entry->d_name) && !stat(path.c_str(), &st) && now - st.st_mtime > staleTempSeconds) {
+                std::remove(path.c_str());
+            }
+        }
+        closedir(dir);
+    }
+
+    std::sort(entries.begin(), entries.end(), [](Entry const& a, Entry const& b) {
+        return a.lastUse.tv_sec != b.lastUse.tv_sec ? a.lastUse.tv_sec < b.lastUse.tv_sec
+                                                    : a.lastUse.tv_nsec < b.lastUse.tv_nsec;
+    });
+    for (auto const& entry : entries) {
+        if (size_ <= maxSize_ / 4 * 3)
+            break;
+        if (!std::remove(entry.path.c_str()))
+            size_ -= entry.size;
+    }
+}
+
+CompiledShader
+ShaderCache::compile(std::uint32_t const* begin, std::uint32_t const* end, std::string const& entryName,
+                     CompileOptions const& options)
+{
+    auto key = computeKey(begin, end, entryName, options);
+    CompiledShader shader;
+    if (lookup(key, shader))
+        return shader;
+
+    shader = algrad::compiler::compile(begin, end, entryName, options);
+    insert(key, shader);
+    return shader;
+}
+}
+}
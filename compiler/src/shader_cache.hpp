@@ -0,0 +1,57 @@
+#ifndef ALGRAD_COMPILER_SHADER_CACHE_HPP
+#define ALGRAD_COMPILER_SHADER_CACHE_HPP
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "compiler.hpp"
+#include "hash.hpp"
+
+namespace algrad {
+namespace compiler {
+
+/*
+ * Content-addressed on-disk cache of compiled shaders. Entries are keyed by a
+ * 128-bit hash of the canonicalized SPIR-V module, the entry point name, the
+ * options that affect the generated code and a compiler version salt, and each
+ * one is stored in its own file. Canonicalization makes modules that only
+ * differ in debug information or id numbering share an entry. Inserts write a
+ * temporary file that is renamed into place, so a crash never leaves a partial
+ * entry behind. Hits refresh the modification time of the entry, and once the
+ * directory grows beyond maxSize bytes the least recently used entries are
+ * removed.
+ *
+ * The cache can be used from multiple threads and processes at once. Errors
+ * while accessing it are not fatal, they just result in a miss.
+ */
+class ShaderCache
+{
+  public:
+    ShaderCache(std::string directory, std::uint64_t maxSize);
+
+    static Hash128 computeKey(std::uint32_t const* begin, std::uint32_t const* end, std::string const& entryName,
+                              CompileOptions const& options);
+
+    bool lookup(Hash128 key, CompiledShader& shader);
+    void insert(Hash128 key, CompiledShader const& shader);
+
+    /* Returns the cached shader if there is one, otherwise compiles and inserts it. */
+    CompiledShader compile(std::uint32_t const* begin, std::uint32_t const* end, std::string const& entryName,
+                           CompileOptions const& options);
+
+  private:
+    std::string entryPath(Hash128 key) const;
+    void evict();
+
+    std::string directory_;
+    std::uint64_t maxSize_;
+
+    std::mutex mutex_;
+    std::uint64_t size_;
+    std::uint64_t tempCounter_;
+};
+}
+}
+
+#endif
@@ -8,10 +8,10 @@
 #include "spirv.hpp"
 
 #include <algorithm>
-#include <cstring>
 #include <iostream>
 #include <unordered_map>
 
+#include <boost/iterator/iterator_facade.hpp>
 #include <boost/range/iterator_range.hpp>
 
 namespace algrad {
@@ -21,6 +21,53 @@ using namespace hir;
 
 namespace {
 
+std::uint32_t
+byteSwap(std::uint32_t v) noexcept
+{
+    return (v >> 24) | ((v >> 8) & 0xff00U) | ((v << 8) & 0xff0000U) | (v << 24);
+}
+
+/*
+ * Iterator over the words of a module. Modules written with the opposite
+ * endianness are byte-swapped a word at a time as they are read, so they
+ * never need to be converted up front.
+ */
+class WordIterator
+  : public boost::iterator_facade<WordIterator, std::uint32_t const, boost::random_access_traversal_tag, std::uint32_t>
+{
+  public:
+    WordIterator() noexcept : ptr_{nullptr}, swap_{false} {}
+    WordIterator(std::uint32_t const* ptr, bool swap) noexcept : ptr_{ptr}, swap_{swap} {}
+
+  private:
+    friend class boost::iterator_core_access;
+
+    std::uint32_t dereference() const noexcept { return swap_ ? byteSwap(*ptr_) : *ptr_; }
+    bool equal(WordIterator const& other) const noexcept { return ptr_ == other.ptr_; }
+    void increment() noexcept { ++ptr_; }
+    void decrement() noexcept { --ptr_; }
+    void advance(std::ptrdiff_t n) noexcept { ptr_ += n; }
+    std::ptrdiff_t distance_to(WordIterator const& other) const noexcept { return other.ptr_ - ptr_; }
+
+    std::uint32_t const* ptr_;
+    bool swap_;
+};
+
+using InsnRange = boost::iterator_range<WordIterator>;
+
+/* Returns whether the module has to be byte-swapped, throws if it is not a SPIR-V module. */
+bool
+needsByteSwap(std::uint32_t const* b, std::uint32_t const* e)
+{
+    if (e - b < 5U)
+        throw - 1;
+    if (b[0] == spv::MagicNumber)
+        return false;
+    if (b[0] == byteSwap(spv::MagicNumber))
+        return true;
+    throw - 1;
+}
+
 unsigned
 wordCount(std::uint32_t v)
 {
@@ -77,22 +124,35 @@ struct SPIRVObject
         Type type;
         Def* def;
     };
-    std::uint32_t const* definition;
+};
+
+/*
+ * Locations of the instructions of a module, found in a single pass so the
+ * later stages can go straight to the sections and definitions they need.
+ * Offsets are in words from the start of the module, 0 means none.
+ */
+struct SPIRVIndex
+{
+    std::uint32_t globalsBegin;
+    std::uint32_t functionsBegin;
+    std::vector<std::uint32_t> definitions;
+    std::vector<std::uint32_t> functionEnds;
 };
 
 struct SPIRVBuilder
 {
     std::string entryName;
+    AllocationMode allocationMode;
+    std::shared_ptr<TypeContext> types;
     unsigned entryId;
     std::vector<unsigned> ioVars;
 
+    WordIterator module;
+    SPIRVIndex index;
+
     std::unique_ptr<hir::Program> program;
     std::vector<SPIRVObject> objects;
     std::vector<std::pair<unsigned, Def *>> inputs, outputs;
-
-    std::unordered_map<unsigned, std::pair<std::uint32_t const*, std::uint32_t const*>> functionStarts;
-
-    unsigned currFunctionId;
 };
 
 SPIRVObject::SPIRVObject() noexcept : tag{Tag::none}
@@ -117,18 +177,26 @@ visitSPIRV(Range r, F&& callback, Args&&... args)
     return cur;
 }
 
-std::pair<std::string, std::uint32_t const*>
-literalString(boost::iterator_range<std::uint32_t const*> r)
+/* The bytes of a string are packed into the words starting at the lowest-order byte. */
+template <typename Iterator>
+std::pair<std::string, Iterator>
+literalString(boost::iterator_range<Iterator> r)
 {
-    char const* b = static_cast<char const*>(static_cast<void const*>(r.begin()));
-    char const* e = static_cast<char const*>(static_cast<void const*>(r.end()));
-    auto it = std::find(b, e, 0);
-
-    return {std::string(b, it), r.begin() + (it - b + 4) / 4};
+    std::string str;
+    for (auto it = r.begin(); it != r.end(); ++it) {
+        std::uint32_t word = *it;
+        for (unsigned i = 0; i < 4; ++i) {
+            char c = static_cast<char>((word >> (8 * i)) & 0xffU);
+            if (!c)
+                return {str, it + 1};
+            str.push_back(c);
+        }
+    }
+    return {str, r.end()};
 }
 
 bool
-visitPreamble(boost::iterator_range<std::uint32_t const*> insn, SPIRVBuilder& builder)
+visitPreamble(InsnRange insn, SPIRVBuilder& builder)
 {
     switch (opCode(insn.front())) {
         case spv::Op::OpCapability: {
@@ -143,7 +211,7 @@ visitPreamble(boost::iterator_range<std::uint32_t const*> insn, SPIRVBuilder& bu
         case spv::Op::OpExtension:
             std::terminate();
         case spv::Op::OpExtInstImport: {
-            auto name = literalString({insn.begin() + 2, insn.end()}).first;
+            auto name = literalString(boost::make_iterator_range(insn.begin() + 2, insn.end())).first;
             if (name != "GLSL.std.450")
                 std::terminate();
             return true;
@@ -153,13 +221,14 @@ visitPreamble(boost::iterator_range<std::uint32_t const*> insn, SPIRVBuilder& bu
         }
         case spv::Op::OpEntryPoint: {
             std::string name;
-            std::uint32_t const* it;
-            std::tie(name, it) = literalString({insn.begin() + 3, insn.end()});
+            WordIterator it;
+            std::tie(name, it) = literalString(boost::make_iterator_range(insn.begin() + 3, insn.end()));
             if (name == builder.entryName) {
                 if (builder.program)
                     std::terminate();
-                builder.program =
-                  std::make_unique<hir::Program>(toProgramType(static_cast<spv::ExecutionModel>(insn.begin()[1])));
+                builder.program = std::make_unique<hir::Program>(
+                  toProgramType(static_cast<spv::ExecutionModel>(insn.begin()[1])), builder.allocationMode,
+                  builder.types);
                 builder.entryId = insn.begin()[2];
 
                 for (; it < insn.end(); ++it)
@@ -194,6 +263,243 @@ visitPreamble(boost::iterator_range<std::uint32_t const*> insn, SPIRVBuilder& bu
     }
 }
 
+bool
+isDebugInstruction(spv::Op op)
+{
+    switch (op) {
+        case spv::Op::OpNop:
+        case spv::Op::OpString:
+        case spv::Op::OpSource:
+        case spv::Op::OpSourceExtension:
+        case spv::Op::OpSourceContinued:
+        case spv::Op::OpName:
+        case spv::Op::OpMemberName:
+        case spv::Op::OpLine:
+        case spv::Op::OpNoLine:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*
+ * Calls callback on every word of insn that is an id. Only knows the instructions the
+ * loader supports and returns false for any other instruction.
+ */
+template <typename F>
+bool
+forEachIdOperand(boost::iterator_range<std::uint32_t*> insn, F&& callback)
+{
+    auto size = insn.size();
+    auto ids = [&](std::size_t begin, std::size_t end) {
+        for (auto i = begin; i < std::min(end, size); ++i)
+            callback(insn.begin()[i]);
+    };
+
+    switch (opCode(insn.front())) {
+        case spv::Op::OpCapability:
+        case spv::Op::OpExtension:
+        case spv::Op::OpMemoryModel:
+        case spv::Op::OpFunctionEnd:
+        case spv::Op::OpReturn:
+            return true;
+        case spv::Op::OpExtInstImport:
+        case spv::Op::OpExecutionMode:
+        case spv::Op::OpDecorate:
+        case spv::Op::OpMemberDecorate:
+        case spv::Op::OpDecorationGroup:
+        case spv::Op::OpTypeVoid:
+        case spv::Op::OpTypeBool:
+        case spv::Op::OpTypeInt:
+        case spv::Op::OpTypeFloat:
+        case spv::Op::OpLabel:
+        case spv::Op::OpBranch:
+        case spv::Op::OpReturnValue:
+        case spv::Op::OpSelectionMerge:
+            ids(1, 2);
+            return true;
+        case spv::Op::OpEntryPoint: {
+            ids(2, 3);
+            auto it = literalString(boost::make_iterator_range(insn.begin() + 3, insn.end())).second;
+            ids(it - insn.begin(), size);
+            return true;
+        }
+        case spv::Op::OpTypeVector:
+        case spv::Op::OpConstant:
+        case spv::Op::OpConstantTrue:
+        case spv::Op::OpConstantFalse:
+        case spv::Op::OpConstantNull:
+        case spv::Op::OpConstantSampler:
+        case spv::Op::OpFunctionParameter:
+        case spv::Op::OpStore:
+        case spv::Op::OpLoopMerge:
+            ids(1, 3);
+            return true;
+        case spv::Op::OpTypePointer:
+            ids(1, 2);
+            ids(3, 4);
+            return true;
+        case spv::Op::OpVariable:
+            ids(1, 3);
+            ids(4, 5);
+            return true;
+        case spv::Op::OpFunction:
+            ids(1, 3);
+            ids(4, 5);
+            return true;
+        case spv::Op::OpLoad:
+        case spv::Op::OpBranchConditional:
+        case spv::Op::OpCompositeExtract:
+            ids(1, 4);
+            return true;
+        case spv::Op::OpVectorShuffle:
+            ids(1, 5);
+            return true;
+        case spv::Op::OpGroupMemberDecorate:
+            ids(1, 2);
+            for (std::size_t i = 2; i < size; i += 2)
+                ids(i, i + 1);
+            return true;
+        case spv::Op::OpGroupDecorate:
+        case spv::Op::OpTypeFunction:
+        case spv::Op::OpConstantComposite:
+        case spv::Op::OpAccessChain:
+        case spv::Op::OpCompositeConstruct:
+        case spv::Op::OpFOrdLessThan:
+        case spv::Op::OpFAdd:
+            ids(1, size);
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* Word index of the result id of the instruction, or 0 if it has none. */
+unsigned
+resultIdIndex(spv::Op op)
+{
+    switch (op) {
+        case spv::Op::OpExtInstImport:
+        case spv::Op::OpString:
+        case spv::Op::OpDecorationGroup:
+        case spv::Op::OpTypeVoid:
+        case spv::Op::OpTypeBool:
+        case spv::Op::OpTypeInt:
+        case spv::Op::OpTypeFloat:
+        case spv::Op::OpTypeVector:
+        case spv::Op::OpTypeMatrix:
+        case spv::Op::OpTypeImage:
+        case spv::Op::OpTypeSampler:
+        case spv::Op::OpTypeSampledImage:
+        case spv::Op::OpTypeArray:
+        case spv::Op::OpTypeRuntimeArray:
+        case spv::Op::OpTypeStruct:
+        case spv::Op::OpTypePointer:
+        case spv::Op::OpTypeFunction:
+        case spv::Op::OpLabel:
+            return 1;
+        case spv::Op::OpUndef:
+        case spv::Op::OpConstant:
+        case spv::Op::OpConstantTrue:
+        case spv::Op::OpConstantFalse:
+        case spv::Op::OpConstantNull:
+        case spv::Op::OpConstantComposite:
+        case spv::Op::OpConstantSampler:
+        case spv::Op::OpVariable:
+        case spv::Op::OpFunction:
+        case spv::Op::OpFunctionParameter:
+        case spv::Op::OpExtInst:
+        case spv::Op::OpAccessChain:
+        case spv::Op::OpLoad:
+        case spv::Op::OpVectorShuffle:
+        case spv::Op::OpCompositeConstruct:
+        case spv::Op::OpCompositeExtract:
+        case spv::Op::OpFOrdLessThan:
+        case spv::Op::OpFAdd:
+        case spv::Op::OpPhi:
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+bool
+isPreambleInstruction(spv::Op op)
+{
+    switch (op) {
+        case spv::Op::OpCapability:
+        case spv::Op::OpExtension:
+        case spv::Op::OpExtInstImport:
+        case spv::Op::OpMemoryModel:
+        case spv::Op::OpEntryPoint:
+        case spv::Op::OpExecutionMode:
+        case spv::Op::OpString:
+        case spv::Op::OpSource:
+        case spv::Op::OpSourceExtension:
+        case spv::Op::OpSourceContinued:
+        case spv::Op::OpName:
+        case spv::Op::OpMemberName:
+        case spv::Op::OpDecorate:
+        case spv::Op::OpDecorationGroup:
+        case spv::Op::OpGroupDecorate:
+        case spv::Op::OpMemberDecorate:
+        case spv::Op::OpGroupMemberDecorate:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*
+ * Walks the module once, recording where the globals and the functions start, which
+ * instruction defines each id and where each function ends. Modules are laid out in
+ * sections, so the preamble is everything before the globals and the globals are
+ * everything before the first function.
+ */
+void
+indexSPIRV(WordIterator b, WordIterator e, SPIRVIndex& index)
+{
+    auto bound = b[3];
+    index.globalsBegin = 0;
+    index.functionsBegin = 0;
+    index.definitions.assign(bound, 0);
+    index.functionEnds.assign(bound, 0);
+
+    std::uint32_t currentFunction = 0;
+    for (auto cur = b + 5; cur != e;) {
+        auto size = wordCount(*cur);
+        if (!size || size > static_cast<std::size_t>(e - cur))
+            throw - 1;
+
+        auto op = opCode(*cur);
+        auto offset = static_cast<std::uint32_t>(cur - b);
+        if (!index.globalsBegin && !isPreambleInstruction(op))
+            index.globalsBegin = offset;
+        if (!index.functionsBegin && op == spv::Op::OpFunction)
+            index.functionsBegin = offset;
+
+        if (auto resultIndex = resultIdIndex(op)) {
+            if (resultIndex >= size || cur[resultIndex] >= bound)
+                throw - 1;
+            index.definitions[cur[resultIndex]] = offset;
+            if (op == spv::Op::OpFunction)
+                currentFunction = cur[resultIndex];
+        } else if (op == spv::Op::OpFunctionEnd) {
+            if (!currentFunction)
+                throw - 1;
+            index.functionEnds[currentFunction] = offset;
+            currentFunction = 0;
+        }
+        cur += size;
+    }
+
+    auto end = static_cast<std::uint32_t>(e - b);
+    if (!index.globalsBegin)
+        index.globalsBegin = end;
+    if (!index.functionsBegin)
+        index.functionsBegin = end;
+}
+
 Type
 getType(SPIRVBuilder& builder, unsigned id)
 {
@@ -204,7 +510,7 @@ getType(SPIRVBuilder& builder, unsigned id)
 }
 
 void
-visitType(boost::iterator_range<std::uint32_t const*> insn, SPIRVBuilder& builder)
+visitType(InsnRange insn, SPIRVBuilder& builder)
 {
     Type type;
     auto id = insn.begin()[1];
@@ -243,28 +549,24 @@ visitType(boost::iterator_range<std::uint32_t const*> insn, SPIRVBuilder& builde
     builder.objects[id].type = type;
 }
 void
-insertConstant(boost::iterator_range<std::uint32_t const*> insn, SPIRVBuilder& builder)
+insertConstant(InsnRange insn, SPIRVBuilder& builder)
 {
     auto id = insn[2];
     auto type = getType(builder, insn[1]);
     hir::ScalarConstant* def;
     if (type->kind() == TypeKind::integer || type->kind() == TypeKind::floatingPoint) {
         switch (static_cast<ScalarTypeInfo const*>(type)->width()) {
-            case 16: {
-                std::uint16_t v;
-                std::memcpy(&v, &insn[3], 2);
-                def = builder.program->getScalarConstant(type, static_cast<std::uint64_t>(v));
-            } break;
-            case 32: {
-                std::uint32_t v;
-                std::memcpy(&v, &insn[3], 4);
-                def = builder.program->getScalarConstant(type, static_cast<std::uint64_t>(v));
-            } break;
-            case 64: {
-                std::uint64_t v;
-                std::memcpy(&v, &insn[3], 8);
-                def = builder.program->getScalarConstant(type, static_cast<std::uint64_t>(v));
-            } break;
+            /* Wider literals start with their low-order word. */
+            case 16:
+                def = builder.program->getScalarConstant(type, static_cast<std::uint64_t>(insn[3] & 0xffffU));
+                break;
+            case 32:
+                def = builder.program->getScalarConstant(type, static_cast<std::uint64_t>(insn[3]));
+                break;
+            case 64:
+                def = builder.program->getScalarConstant(type, static_cast<std::uint64_t>(insn[3]) |
+                                                                 static_cast<std::uint64_t>(insn[4]) << 32);
+                break;
         }
     } else
         std::terminate();
@@ -273,7 +575,7 @@ insertConstant(boost::iterator_range<std::uint32_t const*> insn, SPIRVBuilder& b
 }
 
 bool
-visitGlobals(boost::iterator_range<std::uint32_t const*> insn, SPIRVBuilder& builder)
+visitGlobals(InsnRange insn, SPIRVBuilder& builder)
 {
     switch (opCode(insn.front())) {
         case spv::Op::OpTypeVoid:
@@ -300,29 +602,14 @@ visitGlobals(boost::iterator_range<std::uint32_t const*> insn, SPIRVBuilder& bui
                 std::terminate();
 
             builder.objects[id].tag = SPIRVObject::Tag::lazy_var;
-            builder.objects[id].definition = insn.begin();
-            return true;
-        }
-        default:
-            return false;
-    }
-}
-
-bool
-previsitFunctions(boost::iterator_range<std::uint32_t const*> insn, SPIRVBuilder& builder)
-{
-    switch (opCode(insn.front())) {
-        case spv::Op::OpFunction: {
-            builder.currFunctionId = insn.begin()[2];
-            builder.functionStarts[builder.currFunctionId].first = insn.begin();
             return true;
         }
-        case spv::Op::OpFunctionEnd: {
-            builder.functionStarts.find(builder.currFunctionId)->second.second = insn.begin();
+        case spv::Op::OpNop:
+        case spv::Op::OpLine:
+        case spv::Op::OpNoLine:
             return true;
-        }
         default:
-            return true;
+            return false;
     }
 }
 
@@ -345,7 +632,7 @@ getDef(SPIRVBuilder& builder, unsigned id)
 }
 
 void
-createSimpleInstruction(boost::iterator_range<std::uint32_t const*> insn, SPIRVBuilder& builder, FunctionBuilder& fb,
+createSimpleInstruction(InsnRange insn, SPIRVBuilder& builder, FunctionBuilder& fb,
                         OpCode opCode)
 {
     auto type = getType(builder, insn.begin()[1]);
@@ -361,7 +648,7 @@ createSimpleInstruction(boost::iterator_range<std::uint32_t const*> insn, SPIRVB
 }
 
 void
-createStoreInstruction(boost::iterator_range<std::uint32_t const*> insn, SPIRVBuilder& builder, FunctionBuilder& fb)
+createStoreInstruction(InsnRange insn, SPIRVBuilder& builder, FunctionBuilder& fb)
 {
     auto newInsn = builder.program->createDef<Inst>(OpCode::store, &voidType, 2);
     for (unsigned i = 0; i < 2; ++i)
@@ -371,7 +658,7 @@ createStoreInstruction(boost::iterator_range<std::uint32_t const*> insn, SPIRVBu
 }
 
 void
-createShuffleInstruction(boost::iterator_range<std::uint32_t const*> insn, SPIRVBuilder& builder, FunctionBuilder& fb)
+createShuffleInstruction(InsnRange insn, SPIRVBuilder& builder, FunctionBuilder& fb)
 {
     auto type = getType(builder, insn.begin()[1]);
     auto id = insn.begin()[2];
@@ -390,7 +677,7 @@ createShuffleInstruction(boost::iterator_range<std::uint32_t const*> insn, SPIRV
 }
 
 void
-createCompositeExtractInstruction(boost::iterator_range<std::uint32_t const*> insn, SPIRVBuilder& builder,
+createCompositeExtractInstruction(InsnRange insn, SPIRVBuilder& builder,
                                   FunctionBuilder& fb)
 {
     auto type = getType(builder, insn.begin()[1]);
@@ -410,7 +697,7 @@ createCompositeExtractInstruction(boost::iterator_range<std::uint32_t const*> in
 }
 
 void
-visitLabel(boost::iterator_range<std::uint32_t const*> insn, SPIRVBuilder& builder, FunctionBuilder& fb)
+visitLabel(InsnRange insn, SPIRVBuilder& builder, FunctionBuilder& fb)
 {
     auto id = insn[1];
     if (!fb.currentBlock) {
@@ -439,7 +726,7 @@ getBlock(SPIRVBuilder& builder, FunctionBuilder& fb, unsigned id)
 }
 
 void
-visitBranch(boost::iterator_range<std::uint32_t const*> insn, SPIRVBuilder& builder, FunctionBuilder& fb)
+visitBranch(InsnRange insn, SPIRVBuilder& builder, FunctionBuilder& fb)
 {
     auto& block = getBlock(builder, fb, insn[1]);
 
@@ -450,7 +737,7 @@ visitBranch(boost::iterator_range<std::uint32_t const*> insn, SPIRVBuilder& buil
 }
 
 void
-visitBranchConditional(boost::iterator_range<std::uint32_t const*> insn, SPIRVBuilder& builder, FunctionBuilder& fb)
+visitBranchConditional(InsnRange insn, SPIRVBuilder& builder, FunctionBuilder& fb)
 {
     auto& trueBlock = getBlock(builder, fb, insn[2]);
     auto& falseBlock = getBlock(builder, fb, insn[3]);
@@ -465,7 +752,7 @@ visitBranchConditional(boost::iterator_range<std::uint32_t const*> insn, SPIRVBu
 }
 
 void
-createLocalVariable(boost::iterator_range<std::uint32_t const*> insn, SPIRVBuilder& builder, FunctionBuilder& fb)
+createLocalVariable(InsnRange insn, SPIRVBuilder& builder, FunctionBuilder& fb)
 {
     auto id = insn[2];
     auto type = getType(builder, insn[1]);
@@ -479,7 +766,7 @@ createLocalVariable(boost::iterator_range<std::uint32_t const*> insn, SPIRVBuild
 }
 
 bool
-visitBody(boost::iterator_range<std::uint32_t const*> insn, SPIRVBuilder& builder, FunctionBuilder& fb)
+visitBody(InsnRange insn, SPIRVBuilder& builder, FunctionBuilder& fb)
 {
     switch (opCode(insn.front())) {
         case spv::Op::OpFunction:
@@ -528,6 +815,11 @@ visitBody(boost::iterator_range<std::uint32_t const*> insn, SPIRVBuilder& builde
         case spv::Op::OpLoopMerge:
             /* unused */
             return true;
+        case spv::Op::OpNop:
+        case spv::Op::OpLine:
+        case spv::Op::OpNoLine:
+            /* Debug information, which the cache key leaves out as well. */
+            return true;
         default:
             assert(0 && "unsupported instruction");
             std::terminate();
@@ -537,11 +829,16 @@ visitBody(boost::iterator_range<std::uint32_t const*> insn, SPIRVBuilder& builde
 BasicBlock&
 visitFunction(SPIRVBuilder& builder, BasicBlock& startBlock, unsigned id, std::vector<Def*> const& args)
 {
-    auto loc = builder.functionStarts[id];
+    auto begin = builder.index.definitions[id];
+    auto end = builder.index.functionEnds[id];
+    if (!begin || !end || opCode(builder.module[begin]) != spv::Op::OpFunction)
+        throw - 1;
+
     FunctionBuilder fb;
     fb.startBlock = &startBlock;
     fb.currentBlock = nullptr;
-    visitSPIRV(boost::iterator_range<std::uint32_t const*>{loc.first, loc.second}, visitBody, builder, fb);
+    visitSPIRV(InsnRange{builder.module + begin, builder.module + end}, visitBody,
+               builder, fb);
 
     return *fb.currentBlock;
 }
@@ -550,7 +847,9 @@ void
 createIOVars(SPIRVBuilder& builder)
 {
     for (auto id : builder.ioVars) {
-        auto ptr = builder.objects[id].definition;
+        if (id >= builder.objects.size() || builder.objects[id].tag != SPIRVObject::Tag::lazy_var)
+            throw - 1;
+        auto ptr = builder.module + builder.index.definitions[id];
         auto type = getType(builder, ptr[1]);
         assert(type->kind() == TypeKind::pointer);
         auto v = builder.program->createDef<Inst>(OpCode::variable, type, 0);
@@ -639,23 +938,78 @@ visitEntryFunction(SPIRVBuilder& builder)
 }
 }
 
+bool
+canonicalizeSPIRV(std::uint32_t const* begin, std::uint32_t const* end, std::vector<std::uint32_t>& out)
+{
+    out.clear();
+    bool swap;
+    try {
+        swap = needsByteSwap(begin, end);
+    } catch (...) {
+        return false;
+    }
+
+    WordIterator b{begin, swap}, e{end, swap};
+    auto bound = b[3];
+    std::vector<std::uint32_t> remap(bound, 0);
+    std::uint32_t nextId = 1;
+
+    /* The output is in host order. The generator does not affect the generated code. */
+    out.insert(out.end(), b, b + 5);
+    out[2] = 0;
+
+    for (auto cur = b + 5; cur != e;) {
+        auto size = wordCount(*cur);
+        if (!size || size > static_cast<std::size_t>(e - cur))
+            return false;
+        if (!isDebugInstruction(opCode(*cur))) {
+            auto start = out.size();
+            out.insert(out.end(), cur, cur + size);
+            bool valid = true;
+            auto known = forEachIdOperand({out.data() + start, out.data() + out.size()}, [&](std::uint32_t& id) {
+                if (id >= bound) {
+                    valid = false;
+                    return;
+                }
+                if (!remap[id])
+                    remap[id] = nextId++;
+                id = remap[id];
+            });
+            if (!known || !valid)
+                return false;
+        }
+        cur += size;
+    }
+
+    out[3] = nextId;
+    return true;
+}
+
 std::unique_ptr<hir::Program>
-loadSPIRV(std::uint32_t const* b, std::uint32_t const* e, std::string const& entryName)
+loadSPIRV(std::uint32_t const* begin, std::uint32_t const* end, std::string const& entryName,
+          AllocationMode allocationMode, std::shared_ptr<TypeContext> types)
 {
-    if (e - b < 5U)
-        throw - 1;
+    auto swap = needsByteSwap(begin, end);
+    WordIterator b{begin, swap}, e{end, swap};
 
     SPIRVBuilder builder;
     builder.objects.resize(b[3]);
     builder.entryName = entryName;
-    auto cur = b + 5;
-    cur = visitSPIRV(boost::iterator_range<std::uint32_t const*>{cur, e}, visitPreamble, builder);
+    builder.allocationMode = allocationMode;
+    builder.types = std::move(types);
+    builder.module = b;
+    indexSPIRV(b, e, builder.index);
+
+    auto globals = b + builder.index.globalsBegin;
+    auto functions = b + builder.index.functionsBegin;
+    if (visitSPIRV(InsnRange{b + 5, globals}, visitPreamble, builder) != globals)
+        throw - 1;
 
     if (!builder.program)
         std::terminate();
 
-    cur = visitSPIRV(boost::iterator_range<std::uint32_t const*>{cur, e}, visitGlobals, builder);
-    cur = visitSPIRV(boost::iterator_range<std::uint32_t const*>{cur, e}, previsitFunctions, builder);
+    if (visitSPIRV(InsnRange{globals, functions}, visitGlobals, builder) != functions)
+        throw - 1;
 
     visitEntryFunction(builder);
     return std::move(builder.program);
@@ -3,6 +3,10 @@
 
 #include <memory>
 #include <string>
+#include <vector>
+
+#include "arena.hpp"
+#include "types.hpp"
 
 namespace algrad {
 namespace compiler {
@@ -10,7 +14,17 @@ namespace hir {
 class Program;
 }
 
-std::unique_ptr<hir::Program> loadSPIRV(std::uint32_t const* b, std::uint32_t const* e, std::string const& entryName);
+/*
+ * Rewrites a module into a canonical form that compiles to the same code: debug
+ * instructions are removed, the generator is cleared and the ids are renumbered
+ * densely in the order of their first use. Returns false if the module contains
+ * instructions the loader does not support.
+ */
+bool canonicalizeSPIRV(std::uint32_t const* b, std::uint32_t const* e, std::vector<std::uint32_t>& out);
+
+std::unique_ptr<hir::Program> loadSPIRV(std::uint32_t const* b, std::uint32_t const* e, std::string const& entryName,
+                                        AllocationMode allocationMode = AllocationMode::arena,
+                                        std::shared_ptr<TypeContext> types = nullptr);
 }
 }
 
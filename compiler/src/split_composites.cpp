@@ -60,7 +60,7 @@ splitStore(Program& program, BasicBlock& bb, Inst& insn)
 
     auto storage = static_cast<PointerTypeInfo const*>(insn.getOperand(0)->type())->storage();
     for (std::size_t i = 0; i < count; ++i) {
-        auto type = compositeType(insn.getOperand(0)->type(), i);
+        auto type = compositeType(insn.getOperand(1)->type(), i);
         auto ptrType = program.types().pointerType(type, storage);
 
         auto& addr = bb.insertBefore(insn, program.createDef<Inst>(OpCode::accessChain, ptrType, 2));
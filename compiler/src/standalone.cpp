@@ -1,33 +1,569 @@
+#include "compiler.hpp"
+#include "dominance.hpp"
 #include "hir.hpp"
+#include "hir_inlines.hpp"
 #include "lir.hpp"
-#include "spirv_loader.cpp"
+#include "pass_timing.hpp"
+#include "shader_archive.hpp"
+#include "shader_cache.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
 
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+enum : std::uint64_t
+{
+    defaultCacheSize = 256 << 20
+};
+
+/*
+ * Read-only mapping of an input module. The loader reads the words straight
+ * from the page cache, so a module is never copied before it is compiled.
+ */
+class MappedFile
+{
+  public:
+    explicit MappedFile(char const* path);
+    ~MappedFile() noexcept;
+
+    MappedFile(MappedFile const&) = delete;
+    MappedFile& operator=(MappedFile const&) = delete;
+
+    std::uint32_t const* begin() const noexcept { return data_; }
+    std::uint32_t const* end() const noexcept { return data_ + size_; }
+
+  private:
+    std::uint32_t const* data_;
+    std::size_t size_;
+};
+
+MappedFile::MappedFile(char const* path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw - 1;
+
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size < 4) {
+        close(fd);
+        throw - 1;
+    }
+
+    size_ = static_cast<std::size_t>(st.st_size) / 4;
+    void* data = mmap(nullptr, size_ * 4, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        throw - 1;
+    data_ = static_cast<std::uint32_t const*>(data);
+}
+
+MappedFile::~MappedFile() noexcept
+{
+    munmap(const_cast<std::uint32_t*>(data_), size_ * 4);
+}
+
+void
+writeFile(char const* path, std::vector<std::uint32_t> const& data)
+{
+    std::ofstream out(path, std::ios::binary);
+    out.write(static_cast<char const*>(static_cast<void const*>(data.data())), data.size() * 4);
+    if (!out)
+        throw - 1;
+}
+
+/* Compiles the same module repeatedly to compare the compile throughput of the allocation modes. */
+void
+benchmark(MappedFile const& data, unsigned iterations, algrad::compiler::CompileOptions const& baseOptions)
+{
+    std::pair<char const*, algrad::compiler::AllocationMode> modes[] = {
+      {"arena", algrad::compiler::AllocationMode::arena}, {"heap", algrad::compiler::AllocationMode::heap}};
+
+    for (auto mode : modes) {
+        auto options = baseOptions;
+        options.allocationMode = mode.second;
+        options.types = std::make_shared<algrad::compiler::TypeContext>();
+
+        algrad::compiler::CompiledShader shader;
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned i = 0; i < iterations; ++i)
+            shader = algrad::compiler::compile(data.begin(), data.end(), "main", options, std::move(shader.code));
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        std::cout << mode.first << ": " << iterations << " compiles in " << elapsed.count() << " s, "
+                  << iterations / elapsed.count() << " shaders/s\n";
+    }
+}
+
+/* A directory is searched for .spv files, any other file is a manifest listing one module per line. */
+std::vector<std::string>
+listBatchInputs(char const* path)
+{
+    std::vector<std::string> inputs;
+    struct stat st;
+    if (stat(path, &st))
+        throw - 1;
+
+    if (S_ISDIR(st.st_mode)) {
+        auto dir = opendir(path);
+        if (!dir)
+            throw - 1;
+        while (auto entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name.size() > 4 && !name.compare(name.size() - 4, 4, ".spv"))
+                inputs.push_back(std::string(path) + "/" + name);
+        }
+        closedir(dir);
+        std::sort(inputs.begin(), inputs.end());
+    } else {
+        std::ifstream in(path);
+        if (!in.is_open())
+            throw - 1;
+        for (std::string line; std::getline(in, line);)
+            if (!line.empty())
+                inputs.push_back(line);
+    }
+    return inputs;
+}
+
+std::string
+batchOutputPath(std::string const& input)
+{
+    if (input.size() > 4 && !input.compare(input.size() - 4, 4, ".spv"))
+        return input.substr(0, input.size() - 4) + ".bin";
+    return input + ".bin";
+}
+
+/* Compiles through the cache when there is one. */
+algrad::compiler::CompiledShader
+compileModule(MappedFile const& data, algrad::compiler::CompileOptions const& options,
+              algrad::compiler::ShaderCache* cache)
+{
+    if (cache)
+        return cache->compile(data.begin(), data.end(), "main", options);
+    return algrad::compiler::compile(data.begin(), data.end(), "main", options);
+}
+
+/*
+ * Compiles every module of a batch on a work-stealing pool, writing the code next to each input
+ * and, if archivePath is set, also to an archive keyed by the cache keys.
+ */
 int
-main(int argc, char* argv[])
+compileBatch(char const* path, unsigned threadCount, algrad::compiler::ShaderCache* cache, char const* archivePath,
+             algrad::compiler::CompileOptions options)
+{
+    auto inputs = listBatchInputs(path);
+    algrad::compiler::ShaderArchiveWriter archive;
+    std::mutex archiveMutex;
+    std::vector<double> latencies(inputs.size());
+    std::atomic<unsigned> failures{0};
+    options.types = std::make_shared<algrad::compiler::TypeContext>();
+
+    auto start = std::chrono::steady_clock::now();
+    {
+        algrad::compiler::ThreadPool pool(threadCount);
+        for (std::size_t i = 0; i < inputs.size(); ++i) {
+            pool.submit([&, i]() {
+                auto shaderStart = std::chrono::steady_clock::now();
+                try {
+                    MappedFile data(inputs[i].c_str());
+                    auto shader = compileModule(data, options, cache);
+                    writeFile(batchOutputPath(inputs[i]).c_str(), shader.code);
+                    if (archivePath) {
+                        auto key =
+                          algrad::compiler::ShaderCache::computeKey(data.begin(), data.end(), "main", options);
+                        std::lock_guard<std::mutex> lock(archiveMutex);
+                        archive.add(key, shader.code);
+                    }
+                } catch (...) {
+                    std::cerr << "failed to compile " << inputs[i] << "\n";
+                    ++failures;
+                }
+                std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - shaderStart;
+                latencies[i] = elapsed.count();
+            });
+        }
+        pool.wait();
+        threadCount = pool.threadCount();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    if (archivePath && !archive.write(archivePath)) {
+        std::cerr << "failed to write " << archivePath << "\n";
+        ++failures;
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](std::size_t p) {
+        return latencies.empty() ? 0.0 : latencies[std::min(latencies.size() - 1, latencies.size() * p / 100)];
+    };
+    std::cout << inputs.size() << " shaders on " << threadCount << " threads in " << elapsed.count() << " s, "
+              << inputs.size() / elapsed.count() << " shaders/s, p50 " << percentile(50) * 1000.0 << " ms, p99 "
+              << percentile(99) * 1000.0 << " ms";
+    if (failures)
+        std::cout << ", " << failures << " failed";
+    std::cout << "\n";
+    return failures ? 1 : 0;
+}
+
+/*
+ * Builds a chain of blocks that each interpolate a value and export it together with
+ * values from earlier blocks, so a window of temps stays live across the whole chain.
+ */
+std::unique_ptr<algrad::compiler::lir::Program>
+buildSyntheticProgram(unsigned blockCount)
 {
-    if (argc != 2)
+    using namespace algrad::compiler;
+    enum
+    {
+        window = 24
+    };
+
+    auto program = std::make_unique<lir::Program>();
+    std::vector<lir::Temp_id> controlFlowVars;
+    for (unsigned i = 0; i < blockCount; ++i) {
+        program->blocks().push_back(program->createBlock(i));
+        if (i) {
+            auto& pred = *program->blocks()[i - 1];
+            auto& block = *program->blocks()[i];
+            pred.linearizedSuccessors().push_back(&block);
+            pred.logicalSuccessors().push_back(&block);
+            block.linearizedPredecessors().push_back(&pred);
+            block.logicalPredecessors().push_back(&pred);
+            controlFlowVars.push_back(program->allocate_temp(lir::RegClass::sgpr, 8));
+        }
+    }
+
+    auto params = program->allocate_temp(lir::RegClass::sgpr, 4);
+    auto i = program->allocate_temp(lir::RegClass::vgpr, 4);
+    auto j = program->allocate_temp(lir::RegClass::vgpr, 4);
+    std::vector<lir::Temp_id> values;
+    for (unsigned b = 0; b < blockCount; ++b) {
+        auto& block = *program->blocks()[b];
+        if (!b) {
+            auto start = program->createInst(lir::OpCode::start, 3, 0);
+            start->getDefinition(0) = lir::Arg{params, lir::PhysReg{16 * 4}};
+            start->getDefinition(1) = lir::Arg{i, lir::PhysReg{(0 + 256) * 4}};
+            start->getDefinition(2) = lir::Arg{j, lir::PhysReg{(1 + 256) * 4}};
+            block.instructions().push_back(std::move(start));
+        } else {
+            auto start = program->createInst(lir::OpCode::start_block, 0, 1);
+            start->getOperand(0) = lir::Arg{controlFlowVars[b - 1]};
+            block.instructions().push_back(std::move(start));
+        }
+
+        auto tmp = program->allocate_temp(lir::RegClass::vgpr, 4);
+        auto p1 = program->createInst(lir::OpCode::v_interp_p1_f32, 1, 2);
+        p1->getDefinition(0) = lir::Arg{tmp};
+        p1->getOperand(0) = lir::Arg{i};
+        p1->getOperand(1) = lir::Arg{params, lir::PhysReg{124 * 4}};
+        p1->aux().vintrp.attribute = b % 32;
+        p1->aux().vintrp.channel = 0;
+        block.instructions().push_back(std::move(p1));
+
+        values.push_back(program->allocate_temp(lir::RegClass::vgpr, 4));
+        auto p2 = program->createInst(lir::OpCode::v_interp_p2_f32, 1, 3);
+        p2->getDefinition(0) = lir::Arg{values.back()};
+        p2->getOperand(0) = lir::Arg{tmp};
+        p2->getOperand(1) = lir::Arg{j};
+        p2->getOperand(2) = lir::Arg{params, lir::PhysReg{124 * 4}};
+        p2->aux().vintrp.attribute = b % 32;
+        p2->aux().vintrp.channel = 0;
+        block.instructions().push_back(std::move(p2));
+
+        auto exp = program->createInst(lir::OpCode::exp, 0, 4);
+        for (unsigned k = 0; k < 4; ++k) {
+            auto distance = k * window / 3;
+            exp->getOperand(k) = lir::Arg{values[b >= distance ? b - distance : b]};
+        }
+        exp->aux().exp.enable = 15;
+        exp->aux().exp.target = 0;
+        exp->aux().exp.compressed = false;
+        exp->aux().exp.done = b + 1 == blockCount;
+        exp->aux().exp.validMask = true;
+        block.instructions().push_back(std::move(exp));
+
+        if (b + 1 < blockCount) {
+            auto branch = program->createInst(lir::OpCode::logical_branch, 1, 0);
+            branch->getDefinition(0) = lir::Arg{controlFlowVars[b]};
+            block.instructions().push_back(std::move(branch));
+        } else
+            block.instructions().push_back(program->createInst(lir::OpCode::s_endpgm, 0, 0));
+    }
+    return program;
+}
+
+/*
+ * Builds a chain of blocks that each add a varying value to itself a number of times,
+ * so both the chain of blocks and the chain of uses are as deep as the program.
+ */
+std::unique_ptr<algrad::compiler::hir::Program>
+buildSyntheticShader(unsigned blockCount, unsigned instsPerBlock)
+{
+    using namespace algrad::compiler;
+
+    auto program = std::make_unique<hir::Program>(hir::ProgramType::fragment);
+    hir::Def* value = &program->appendParam(
+      program->createDef<hir::Inst>(hir::OpCode::parameter, &float32Type, hir::InstFlags::alwaysVarying, 0));
+
+    hir::BasicBlock* pred = nullptr;
+    for (unsigned b = 0; b < blockCount; ++b) {
+        auto& block = program->insertBack(program->createBasicBlock());
+        if (pred) {
+            pred->insertBack(program->createDef<hir::Inst>(hir::OpCode::branch, &voidType, 0));
+            pred->successors().push_back(&block);
+            block.insertPredecessor(pred);
+        }
+
+        for (unsigned i = 0; i < instsPerBlock; ++i) {
+            auto& add = block.insertBack(program->createDef<hir::Inst>(hir::OpCode::floatAdd, &float32Type, 2));
+            add.setOperand(0, value);
+            add.setOperand(1, value);
+            value = &add;
+        }
+        pred = &block;
+    }
+
+    auto& exp = pred->insertBack(program->createDef<hir::Inst>(hir::OpCode::gcnExport, &voidType, 1));
+    exp.setOperand(0, value);
+    pred->insertBack(program->createDef<hir::Inst>(hir::OpCode::ret, &voidType, 0));
+    return program;
+}
+
+/* Runs the passes that walk the CFG or the use chains on programs of increasing size, to check they scale linearly. */
+void
+benchmarkScaling(unsigned maxBlockCount)
+{
+    enum
+    {
+        instsPerBlock = 10
+    };
+
+    for (int shift = 6; shift >= 0; shift -= 2) {
+        auto blockCount = std::max(maxBlockCount >> shift, 1U);
+        auto program = buildSyntheticShader(blockCount, instsPerBlock);
+        auto start = std::chrono::steady_clock::now();
+        algrad::compiler::orderBlocksRPO(*program);
+        algrad::compiler::hir::DominatorTree dominators, postDominators;
+        dominators.computeDominators(*program);
+        postDominators.computePostDominators(*program);
+        algrad::compiler::eliminateDeadCode(*program);
+        algrad::compiler::determineDivergence(*program);
+        std::chrono::duration<double> hirElapsed = std::chrono::steady_clock::now() - start;
+
+        auto lprog = buildSyntheticProgram(blockCount);
+        start = std::chrono::steady_clock::now();
+        algrad::compiler::allocateRegisters(*lprog);
+        std::chrono::duration<double> lirElapsed = std::chrono::steady_clock::now() - start;
+
+        std::cout << "blocks " << blockCount << ", instructions " << blockCount * instsPerBlock
+                  << ": hir passes " << hirElapsed.count() * 1000.0 << " ms, register allocation "
+                  << lirElapsed.count() * 1000.0 << " ms\n";
+    }
+}
+
+/* Measures writing an archive of random code blobs, and the startup and lookup time when mapping it again. */
+void
+benchmarkArchive(unsigned entryCount)
+{
+    char const* path = "bench_archive.bin";
+    std::mt19937_64 rng(1);
+    std::vector<algrad::compiler::Hash128> keys;
+    algrad::compiler::ShaderArchiveWriter writer;
+    for (unsigned i = 0; i < entryCount; ++i) {
+        std::vector<std::uint32_t> code(16 + rng() % 512);
+        for (auto& w : code)
+            w = static_cast<std::uint32_t>(rng());
+        keys.push_back({rng(), rng()});
+        writer.add(keys.back(), code);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    if (!writer.write(path))
         throw - 1;
-    std::ifstream in(argv[1]);
-    if (!in.is_open())
+    std::chrono::duration<double> writeTime = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    algrad::compiler::ShaderArchive archive;
+    if (!archive.open(path) || !archive.lookup(keys[entryCount / 2]).data)
         throw - 1;
-    in.seekg(0, std::ios::end);
-    std::vector<std::uint32_t> data(in.tellg() / 4);
-    in.seekg(0, std::ios::beg);
-    in.read(static_cast<char*>(static_cast<void*>(data.data())), data.size() * 4);
-    auto prog = algrad::compiler::loadSPIRV(data.data(), data.data() + data.size(), "main");
-    algrad::compiler::orderBlocksRPO(*prog);
-    algrad::compiler::splitComposites(*prog);
-    algrad::compiler::promoteVariables(*prog);
-    algrad::compiler::eliminateDeadCode(*prog);
-    algrad::compiler::lowerIO(*prog);
-    algrad::compiler::determineDivergence(*prog);
-    print(std::cout, *prog);
-
-    auto lprog = algrad::compiler::selectInstructions(*prog);
-    algrad::compiler::allocateRegisters(*lprog);
-    print(std::cout, *lprog);
-
-    algrad::compiler::emit(*lprog);
+    std::chrono::duration<double> startupTime = std::chrono::steady_clock::now() - start;
+
+    std::shuffle(keys.begin(), keys.end(), rng);
+    std::uint32_t checksum = 0;
+    start = std::chrono::steady_clock::now();
+    for (auto key : keys) {
+        auto code = archive.lookup(key);
+        if (!code.data)
+            throw - 1;
+        checksum ^= code.data[code.size - 1];
+    }
+    std::chrono::duration<double> lookupTime = std::chrono::steady_clock::now() - start;
+    std::remove(path);
+
+    std::cout << entryCount << " entries: write " << writeTime.count() * 1000.0 << " ms, open and first lookup "
+              << startupTime.count() * 1000000.0 << " us, " << lookupTime.count() * 1e9 / entryCount
+              << " ns per lookup (checksum " << checksum << ")\n";
+}
+
+/* Measures register allocation alone on synthetic programs of increasing size. */
+void
+benchmarkRegisterAllocation(unsigned maxBlockCount)
+{
+    for (unsigned blockCount = 16; blockCount <= maxBlockCount; blockCount *= 4) {
+        auto program = buildSyntheticProgram(blockCount);
+        auto temps = program->allocated_temp_count();
+
+        auto start = std::chrono::steady_clock::now();
+        algrad::compiler::allocateRegisters(*program);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        std::cout << "blocks " << blockCount << ", temps " << temps << ": " << elapsed.count() * 1000.0 << " ms\n";
+    }
+}
+
+void
+printUsage(char const* name)
+{
+    std::cerr << "usage: " << name << " [options] <module.spv>\n"
+              << "       " << name << " [options] -batch <manifest>\n"
+              << "       " << name << " -bench-archive|-bench-ra|-bench-scale <count>\n"
+              << "options:\n"
+              << "  -O0, -O2                     optimization level\n"
+              << "  -j <threads>                 threads for -batch\n"
+              << "  -cache <directory>           compile through an on-disk cache\n"
+              << "  -archive <path>              also write the -batch results to an archive\n"
+              << "  -time-passes[-json]          print pass statistics to stderr\n"
+              << "  -trace <path>                write a Chrome trace of the compiles\n"
+              << "  -bench <iterations>          time compiling the module\n";
+}
+}
+
+int
+main(int argc, char* argv[])
+{
+    unsigned benchIterations = 0;
+    unsigned threadCount = 0;
+    char const* cachePath = nullptr;
+    char const* archivePath = nullptr;
+    char const* tracePath = nullptr;
+    bool timePasses = false, timingsJSON = false;
+    algrad::compiler::CompileOptions options;
+
+    /* Options can come in any order, the mode is either one of the commands taking a value or an input module. */
+    char const* mode = nullptr;
+    char const* modeValue = nullptr;
+    char const* input = nullptr;
+    for (int arg = 1; arg < argc; ++arg) {
+        auto option = argv[arg];
+        auto is = [option](char const* name) { return !std::strcmp(option, name); };
+        if (is("-time-passes") || is("-time-passes-json")) {
+            timePasses = true;
+            timingsJSON = is("-time-passes-json");
+        } else if (option[0] == '-' && option[1] == 'O') {
+            if (!algrad::compiler::parseOptimizationLevel(option + 1, options.optimizationLevel)) {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (option[0] != '-') {
+            if (input) {
+                printUsage(argv[0]);
+                return 1;
+            }
+            input = option;
+        } else if (arg + 1 == argc) {
+            printUsage(argv[0]);
+            return 1;
+        } else if (is("-j")) {
+            threadCount = std::strtoul(argv[++arg], nullptr, 10);
+        } else if (is("-cache")) {
+            cachePath = argv[++arg];
+        } else if (is("-archive")) {
+            archivePath = argv[++arg];
+        } else if (is("-trace")) {
+            tracePath = argv[++arg];
+        } else if (is("-bench")) {
+            benchIterations = std::strtoul(argv[++arg], nullptr, 10);
+        } else if (!mode && (is("-batch") || is("-bench-archive") || is("-bench-ra") || is("-bench-scale"))) {
+            mode = option;
+            modeValue = argv[++arg];
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (!mode == !input) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    std::unique_ptr<algrad::compiler::ShaderCache> cache;
+    if (cachePath)
+        cache = std::make_unique<algrad::compiler::ShaderCache>(cachePath, defaultCacheSize);
+
+    /* Statistics are summed over every compile of the run, they and the trace are written at the end. */
+    std::unique_ptr<algrad::compiler::PassTimings> timings;
+    if (timePasses)
+        timings = std::make_unique<algrad::compiler::PassTimings>();
+    std::unique_ptr<algrad::compiler::TraceSink> trace;
+    if (tracePath)
+        trace = std::make_unique<algrad::compiler::TraceSink>();
+    auto writeReports = [&]() {
+        if (timings && timingsJSON)
+            timings->printJSON(std::cerr);
+        else if (timings)
+            timings->print(std::cerr);
+        if (trace) {
+            std::ofstream out(tracePath);
+            trace->write(out);
+            if (!out)
+                std::cerr << "failed to write " << tracePath << "\n";
+        }
+    };
+    options.timings = timings.get();
+    options.trace = trace.get();
+
+    if (mode && !std::strcmp(mode, "-batch")) {
+        auto ret = compileBatch(modeValue, threadCount, cache.get(), archivePath, options);
+        writeReports();
+        return ret;
+    }
+    if (mode && !std::strcmp(mode, "-bench-archive")) {
+        benchmarkArchive(std::strtoul(modeValue, nullptr, 10));
+        return 0;
+    }
+    if (mode && !std::strcmp(mode, "-bench-ra")) {
+        benchmarkRegisterAllocation(std::strtoul(modeValue, nullptr, 10));
+        return 0;
+    }
+    if (mode) {
+        benchmarkScaling(std::strtoul(modeValue, nullptr, 10));
+        return 0;
+    }
+
+    MappedFile data(input);
+    if (benchIterations) {
+        benchmark(data, benchIterations, options);
+        writeReports();
+        return 0;
+    }
+
+    options.dump = &std::cout;
+    auto shader = compileModule(data, options, cache.get());
+    writeFile("test.bin", shader.code);
+    writeReports();
 }
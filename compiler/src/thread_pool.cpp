@@ -0,0 +1,137 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+namespace algrad {
+namespace compiler {
+
+namespace {
+/* The pool and queue index of the worker running on this thread, if any. */
+thread_local ThreadPool const* currentPool = nullptr;
+thread_local unsigned currentQueue = 0;
+}
+
+ThreadPool::ThreadPool(unsigned threadCount) : nextQueue_{0}, queued_{0}, unfinished_{0}, sleeping_{0}, stop_{false}
+{
+    if (!threadCount)
+        threadCount = std::max(std::thread::hardware_concurrency(), 1U);
+
+    for (unsigned i = 0; i < threadCount; ++i)
+        queues_.push_back(std::make_unique<Queue>());
+    for (unsigned i = 0; i < threadCount; ++i)
+        threads_.emplace_back([this, i]() { run(i); });
+}
+
+ThreadPool::~ThreadPool() noexcept
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto& thread : threads_)
+        thread.join();
+}
+
+void
+ThreadPool::submit(std::function<void()> task)
+{
+    unsigned index;
+    if (currentPool == this)
+        index = currentQueue;
+    else
+        index = nextQueue_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+
+    {
+        auto& queue = *queues_[index];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+    unfinished_.fetch_add(1);
+    queued_.fetch_add(1);
+
+    /*
+     * A worker registers as sleeping before it checks queued_ under the mutex
+     * one last time, so either it sees the task or it is seen here.
+     */
+    if (sleeping_.load()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        wake_.notify_one();
+    }
+}
+
+void
+ThreadPool::wait()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_.wait(lock, [this]() { return !unfinished_.load(); });
+}
+
+bool
+ThreadPool::claim() noexcept
+{
+    auto count = queued_.load();
+    while (count && !queued_.compare_exchange_weak(count, count - 1)) {
+    }
+    return count;
+}
+
+void
+ThreadPool::finish()
+{
+    if (unfinished_.fetch_sub(1) == 1) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        idle_.notify_all();
+    }
+}
+
+std::function<void()>
+ThreadPool::take(unsigned index)
+{
+    /* A task has been claimed through queued_, so one of the queues is guaranteed to hold it. */
+    for (;;) {
+        {
+            auto& queue = *queues_[index];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.tasks.empty()) {
+                auto task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+                return task;
+            }
+        }
+        for (std::size_t i = 1; i < queues_.size(); ++i) {
+            auto& queue = *queues_[(index + i) % queues_.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.tasks.empty()) {
+                auto task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+                return task;
+            }
+        }
+        std::this_thread::yield();
+    }
+}
+
+void
+ThreadPool::run(unsigned index)
+{
+    currentPool = this;
+    currentQueue = index;
+
+    for (;;) {
+        if (claim()) {
+            take(index)();
+            finish();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        ++sleeping_;
+        wake_.wait(lock, [this]() { return stop_ || queued_.load(); });
+        --sleeping_;
+        if (stop_ && !queued_.load())
+            return;
+    }
+}
+}
+}
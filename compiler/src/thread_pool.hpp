@@ -0,0 +1,72 @@
+#ifndef ALGRAD_COMPILER_THREAD_POOL_HPP
+#define ALGRAD_COMPILER_THREAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace algrad {
+namespace compiler {
+
+/*
+ * Work-stealing thread pool. Every worker has its own queue; tasks submitted
+ * from a worker go to the back of its queue and are taken from there again,
+ * idle workers steal from the front of the other queues. Tasks submitted from
+ * outside the pool are spread round-robin over the queues.
+ */
+class ThreadPool
+{
+  public:
+    /* Zero threads means one per hardware thread. */
+    explicit ThreadPool(unsigned threadCount = 0);
+    ~ThreadPool() noexcept;
+
+    ThreadPool(ThreadPool const&) = delete;
+    ThreadPool& operator=(ThreadPool const&) = delete;
+
+    unsigned threadCount() const noexcept { return static_cast<unsigned>(threads_.size()); }
+
+    void submit(std::function<void()> task);
+
+    /* Blocks until every submitted task has finished. */
+    void wait();
+
+  private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void run(unsigned index);
+    std::function<void()> take(unsigned index);
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> threads_;
+    std::atomic<unsigned> nextQueue_;
+
+    bool claim() noexcept;
+    void finish();
+
+    /*
+     * Counts tasks that are queued and not yet claimed by a worker, and tasks
+     * that have not finished. The mutex is only taken to put workers to sleep
+     * or wake them, and when the last task finishes.
+     */
+    std::atomic<std::size_t> queued_;
+    std::atomic<std::size_t> unfinished_;
+    std::atomic<unsigned> sleeping_;
+    std::mutex mutex_;
+    std::condition_variable wake_, idle_;
+    bool stop_;
+};
+}
+}
+
+#endif
@@ -0,0 +1,86 @@
+#include "trace.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <iomanip>
+#include <ostream>
+
+namespace algrad {
+namespace compiler {
+
+namespace {
+std::atomic<std::uint64_t> nextSinkId{1};
+std::atomic<unsigned> nextThreadId{1};
+
+/* Trace thread ids are small and stay the same for every sink a thread records to. */
+unsigned
+currentThreadId()
+{
+    thread_local unsigned id = nextThreadId++;
+    return id;
+}
+
+double
+microseconds(TraceSink::Clock::duration d)
+{
+    return std::chrono::duration<double, std::micro>(d).count();
+}
+}
+
+TraceSink::TraceSink() : id_{nextSinkId++}, origin_{Clock::now()}
+{
+}
+
+TraceSink::Buffer&
+TraceSink::threadBuffer()
+{
+    /* Sinks are identified by id rather than address, which a later sink could reuse. */
+    thread_local std::uint64_t cachedSink = 0;
+    thread_local Buffer* cachedBuffer = nullptr;
+    if (cachedSink == id_)
+        return *cachedBuffer;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    buffers_.push_back(std::make_unique<Buffer>());
+    buffers_.back()->thread = currentThreadId();
+    cachedSink = id_;
+    cachedBuffer = buffers_.back().get();
+    return *cachedBuffer;
+}
+
+void
+TraceSink::addSpan(char const* category, char const* name, Clock::time_point begin, Clock::time_point end,
+                   Hash128 shader)
+{
+    threadBuffer().events.push_back({category, name, begin, end, shader});
+}
+
+void
+TraceSink::write(std::ostream& os) const
+{
+    bool first = true;
+    auto flags = os.flags();
+    auto precision = os.precision();
+    os << std::fixed << std::setprecision(3);
+    os << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    for (auto const& buffer : buffers_) {
+        os << (first ? "\n" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": "
+           << buffer->thread << ", \"args\": {\"name\": \"thread " << buffer->thread << "\"}}";
+        first = false;
+
+        for (auto const& event : buffer->events) {
+            char shader[40];
+            std::snprintf(shader, sizeof(shader), "%016llx%016llx", static_cast<unsigned long long>(event.shader.high),
+                          static_cast<unsigned long long>(event.shader.low));
+            os << ",\n{\"name\": \"" << event.name << "\", \"cat\": \"" << event.category
+               << "\", \"ph\": \"X\", \"ts\": " << microseconds(event.begin - origin_)
+               << ", \"dur\": " << microseconds(event.end - event.begin) << ", \"pid\": 1, \"tid\": " << buffer->thread
+               << ", \"args\": {\"shader\": \"" << shader << "\"}}";
+        }
+    }
+    os << "\n]}\n";
+    os.flags(flags);
+    os.precision(precision);
+}
+}
+}
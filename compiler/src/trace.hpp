@@ -0,0 +1,63 @@
+#ifndef ALGRAD_COMPILER_TRACE_HPP
+#define ALGRAD_COMPILER_TRACE_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "hash.hpp"
+
+namespace algrad {
+namespace compiler {
+
+/*
+ * Collects spans to be written as Chrome trace events. Every thread appends
+ * to a buffer of its own, so the mutex is only taken the first time a thread
+ * records a span and recording does not serialize concurrent compiles.
+ */
+class TraceSink
+{
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    TraceSink();
+
+    TraceSink(TraceSink const&) = delete;
+    TraceSink& operator=(TraceSink const&) = delete;
+
+    /* The strings are not copied, so they have to outlive the sink. */
+    void addSpan(char const* category, char const* name, Clock::time_point begin, Clock::time_point end,
+                 Hash128 shader);
+
+    /* Writes the trace_event JSON, no span may be added concurrently. */
+    void write(std::ostream& os) const;
+
+  private:
+    struct Event
+    {
+        char const* category;
+        char const* name;
+        Clock::time_point begin, end;
+        Hash128 shader;
+    };
+
+    struct Buffer
+    {
+        unsigned thread;
+        std::vector<Event> events;
+    };
+
+    Buffer& threadBuffer();
+
+    std::uint64_t id_;
+    Clock::time_point origin_;
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<Buffer>> buffers_;
+};
+}
+}
+
+#endif
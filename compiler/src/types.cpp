@@ -1,5 +1,7 @@
 #include "types.hpp"
 
+#include <mutex>
+
 namespace algrad {
 namespace compiler {
 
@@ -65,34 +67,43 @@ TypeContext::TypeInfoDeleter::operator()(TypeInfo* ti) noexcept
     }
 }
 
-Type
-TypeContext::vectorType(Type element, unsigned count)
+std::size_t
+TypeContext::TypeKeyHash::operator()(TypeKey const& key) const noexcept
 {
-    for (auto& ti : typeInfos_) {
-        if (ti->kind() != TypeKind::vector)
-            continue;
+    auto h = std::hash<Type>{}(key.base);
+    h ^= (static_cast<std::size_t>(key.param) * 31U + static_cast<std::size_t>(key.kind)) * 0x9E3779B9U;
+    return h;
+}
 
-        auto& vti = static_cast<VectorTypeInfo&>(*ti);
-        if (vti.element() == element && vti.size() == count)
-            return &vti;
+template <typename F>
+Type
+TypeContext::intern(TypeKey const& key, F&& create)
+{
+    {
+        std::shared_lock<std::shared_timed_mutex> lock(mutex_);
+        auto it = typeInfos_.find(key);
+        if (it != typeInfos_.end())
+            return it->second.get();
     }
-    typeInfos_.push_back(std::unique_ptr<TypeInfo, TypeInfoDeleter>{new VectorTypeInfo{element, count}});
-    return typeInfos_.back().get();
+
+    std::unique_lock<std::shared_timed_mutex> lock(mutex_);
+    auto& entry = typeInfos_[key];
+    if (!entry)
+        entry.reset(create());
+    return entry.get();
 }
 
 Type
-TypeContext::pointerType(Type pointee, StorageKind storage)
+TypeContext::vectorType(Type element, unsigned count)
 {
-    for (auto& ti : typeInfos_) {
-        if (ti->kind() != TypeKind::pointer)
-            continue;
+    return intern(TypeKey{TypeKind::vector, element, count}, [&] { return new VectorTypeInfo{element, count}; });
+}
 
-        auto& pti = static_cast<PointerTypeInfo&>(*ti);
-        if (pti.pointeeType() == pointee && pti.storage() == storage)
-            return &pti;
-    }
-    typeInfos_.push_back(std::unique_ptr<TypeInfo, TypeInfoDeleter>{new PointerTypeInfo{pointee, storage}});
-    return typeInfos_.back().get();
+Type
+TypeContext::pointerType(Type pointee, StorageKind storage)
+{
+    return intern(TypeKey{TypeKind::pointer, pointee, static_cast<unsigned>(storage)},
+                  [&] { return new PointerTypeInfo{pointee, storage}; });
 }
 
 bool
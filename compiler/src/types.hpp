@@ -2,8 +2,11 @@
 #define ALGRAD_COMPILER_TYPES_HPP
 
 #include <cassert>
+#include <cstdlib>
 #include <cstdint>
 #include <memory>
+#include <shared_mutex>
+#include <unordered_map>
 #include <vector>
 
 namespace algrad {
@@ -86,6 +89,11 @@ class PointerTypeInfo final : public TypeInfo
     Type pointeeType_;
 };
 
+/*
+ * Interns the derived types, so types can be compared by pointer. A context
+ * can be shared between programs, also when they are compiled on different
+ * threads. Lookups of existing types only take a shared lock.
+ */
 class TypeContext
 {
   public:
@@ -98,7 +106,28 @@ class TypeContext
         void operator()(TypeInfo*) noexcept;
     };
 
-    std::vector<std::unique_ptr<TypeInfo, TypeInfoDeleter>> typeInfos_;
+    struct TypeKey
+    {
+        TypeKind kind;
+        Type base;
+        unsigned param;
+
+        bool operator==(TypeKey const& other) const noexcept
+        {
+            return kind == other.kind && base == other.base && param == other.param;
+        }
+    };
+
+    struct TypeKeyHash
+    {
+        std::size_t operator()(TypeKey const& key) const noexcept;
+    };
+
+    template <typename F>
+    Type intern(TypeKey const& key, F&& create);
+
+    mutable std::shared_timed_mutex mutex_;
+    std::unordered_map<TypeKey, std::unique_ptr<TypeInfo, TypeInfoDeleter>, TypeKeyHash> typeInfos_;
 };
 
 extern TypeInfo const voidType;
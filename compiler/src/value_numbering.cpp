@@ -0,0 +1,112 @@
+#include "dominance.hpp"
+#include "hir.hpp"
+#include "hir_inlines.hpp"
+
+#include <cstddef>
+#include <functional>
+#include <unordered_set>
+#include <vector>
+
+namespace algrad {
+namespace compiler {
+
+using namespace hir;
+
+namespace {
+/*
+ * Instructions that compute the same value from the same operands. Loads are
+ * left alone, as nothing tells whether a store in between changes the memory,
+ * and so are phis, whose operands on back edges can still be replaced after
+ * they have been hashed.
+ */
+bool
+canBeNumbered(Inst& inst) noexcept
+{
+    if (!!(inst.flags() & (InstFlags::hasSideEffects | InstFlags::isControlInstruction)))
+        return false;
+    switch (inst.opCode()) {
+        case OpCode::parameter:
+        case OpCode::variable:
+        case OpCode::phi:
+        case OpCode::load:
+            return false;
+        default:
+            return true;
+    }
+}
+
+bool
+isCommutative(OpCode opCode) noexcept
+{
+    return opCode == OpCode::floatAdd;
+}
+
+struct InstHash
+{
+    std::size_t operator()(Inst* inst) const noexcept
+    {
+        auto h = std::hash<Type>{}(inst->type()) * 31 + static_cast<std::size_t>(inst->opCode());
+        std::size_t operands = 0;
+        for (std::size_t i = 0; i < inst->operandCount(); ++i) {
+            auto op = std::hash<Def*>{}(inst->getOperand(i)) * 0x9E3779B97F4A7C15ULL;
+            operands = isCommutative(inst->opCode()) ? operands + op : operands * 31 + op;
+        }
+        return h ^ operands ^ (operands >> 29);
+    }
+};
+
+struct InstEqual
+{
+    bool operator()(Inst* a, Inst* b) const noexcept
+    {
+        if (a->opCode() != b->opCode() || a->type() != b->type() || a->operandCount() != b->operandCount())
+            return false;
+
+        bool same = true;
+        for (std::size_t i = 0; i < a->operandCount() && same; ++i)
+            same = a->getOperand(i) == b->getOperand(i);
+        if (!same && isCommutative(a->opCode()))
+            same = a->getOperand(0) == b->getOperand(1) && a->getOperand(1) == b->getOperand(0);
+        return same;
+    }
+};
+}
+
+/*
+ * Dominator-scoped value numbering: the instructions of the blocks that
+ * dominate the current one are kept in a hash table, so an instruction that
+ * matches one of them can be replaced by it. Operands are visited before
+ * their users, so they have already been replaced by the time an instruction
+ * is hashed. Unreachable blocks are not in the tree and are numbered on their own.
+ */
+void
+eliminateCommonSubexpressions(Program& program, DominatorTree const& dominators)
+{
+    std::unordered_set<Inst*, InstHash, InstEqual> available;
+    std::vector<Inst*> log;
+    std::vector<std::size_t> logSizes;
+    auto enter = [&](BasicBlock& bb) {
+        logSizes.push_back(log.size());
+        for (auto it = bb.instructions().begin(); it != bb.instructions().end();) {
+            auto& inst = *it++;
+            if (!canBeNumbered(inst))
+                continue;
+
+            auto result = available.insert(&inst);
+            if (result.second) {
+                log.push_back(&inst);
+                continue;
+            }
+            replace(inst, **result.first);
+            bb.erase(inst);
+        }
+    };
+    auto leave = [&](BasicBlock&) {
+        for (; log.size() > logSizes.back(); log.pop_back())
+            available.erase(log.back());
+        logSizes.pop_back();
+    };
+    dominators.walk(program, enter, leave);
+}
+}
+}